@@ -0,0 +1,154 @@
+#ifndef SLATE_CLUSTERSTATE_H
+#define SLATE_CLUSTERSTATE_H
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/optional.hpp>
+
+#include "rapidjson/document.h"
+
+#include "Kubernetes.h"
+
+///The state of a sandbox pod which is relevant to the spawner
+struct PodState{
+	std::string name;
+	///Whether the pod's Ready condition is true
+	bool ready;
+	///Whether the pod has been scheduled and its containers started
+	bool running;
+	///Whether the pod has been marked for deletion
+	bool terminating;
+	///Whether the pod has stopped for good, as an evicted pod has
+	bool finished;
+	///The address of the node on which the pod is running, if known
+	std::string hostIP;
+};
+
+///Extract the interesting parts of a pod object
+///\throws std::runtime_error if the object is malformed
+PodState parsePodState(const rapidjson::Value& pod);
+
+///Extract the node port of the first port exposed by a service object
+///\throws std::runtime_error if the object is malformed or has no node port
+unsigned int parseNodePort(const rapidjson::Value& service);
+
+///An in-memory picture of the sandbox pods and services in one namespace,
+///kept current by background threads which list and then watch the objects.
+///Lookups are keyed by the globusID of the owning user.
+class ClusterState{
+public:
+	///\param kube the client used to talk to the API server
+	///\param ns the namespace containing the sandboxes
+	ClusterState(const kubernetes::Client& kube, const std::string& ns);
+	///Stops the background threads
+	~ClusterState();
+
+	ClusterState(const ClusterState&)=delete;
+	ClusterState& operator=(const ClusterState&)=delete;
+
+	///Start the background threads which keep the state current
+	void start();
+
+	///\return whether both pods and services have been listed successfully
+	///        and are being watched. When this is false lookups are not
+	///        authoritative and the API server should be asked instead.
+	bool synced() const;
+
+	///Find the state of a user's pod
+	///\param globusID the ID of the user owning the pod
+	///\param podName the name of the pod
+	///\return the pod state, or nothing if no such pod is known
+	boost::optional<PodState> findPod(const std::string& globusID, const std::string& podName) const;
+
+	///Find all of a user's pods
+	///\param globusID the ID of the user owning the pods
+	///\return the states of the pods, which may be empty
+	std::vector<PodState> findPods(const std::string& globusID) const;
+
+	///Find the node port of a user's service
+	///\param globusID the ID of the user owning the service
+	///\return the port, or nothing if no service is known for the user
+	boost::optional<unsigned int> findNodePort(const std::string& globusID) const;
+	
+	///A function to be called when something about a user's pods changes
+	typedef std::function<void()> ChangeCallback;
+	
+	///Arrange for a function to be called whenever a user's pods change. The 
+	///function is called from a background thread, and so should do as little
+	///as possible. 
+	///\param globusID the ID of the user whose pods are of interest
+	///\param callback the function to call
+	///\return a handle with which to unsubscribe
+	std::size_t subscribe(const std::string& globusID, ChangeCallback callback);
+	
+	///Stop calling a function previously passed to subscribe(). The function 
+	///may still be running on another thread when this returns. 
+	///\param globusID the ID of the user for whom the subscription was made
+	///\param handle the handle returned by subscribe()
+	void unsubscribe(const std::string& globusID, std::size_t handle);
+	
+	///A function to be called with the ID of a user whose pods or service 
+	///changed, or with the empty string if any user's may have changed
+	typedef std::function<void(const std::string&)> ObserverCallback;
+	
+	///Arrange for a function to be called whenever any user's pods or service 
+	///change. Like subscribers, observers are called from a background thread.
+	///Observers cannot be removed, so they should be added once at startup. 
+	void observe(ObserverCallback observer);
+
+private:
+	const kubernetes::Client& kube;
+	const std::string ns;
+
+	mutable std::mutex mut;
+	///pods, indexed by user and then by pod name
+	std::map<std::string,std::map<std::string,PodState>> pods;
+	///service node ports, indexed by user
+	std::map<std::string,unsigned int> nodePorts;
+
+	std::mutex subscriberMut;
+	std::size_t nextSubscription;
+	///functions waiting for pod changes, indexed by user and then by handle
+	std::map<std::string,std::map<std::size_t,ChangeCallback>> subscribers;
+	///functions interested in changes for all users
+	std::vector<ObserverCallback> observers;
+
+	std::atomic<bool> podsSynced, servicesSynced;
+	std::atomic<bool> stop;
+	std::thread podThread, serviceThread;
+
+	///Repeatedly list and then watch one kind of object until stopped
+	///\param kind the kind of object
+	///\param labelSelector the selector for the objects of interest
+	///\param synced the flag to maintain for whether this kind is up to date
+	///\param replace the function which replaces all known objects with the
+	///               contents of a list
+	///\param update the function which applies a single watch event
+	void inform(kubernetes::Kind kind, const std::string& labelSelector, std::atomic<bool>& synced,
+	            void (ClusterState::*replace)(const rapidjson::Value&),
+	            void (ClusterState::*update)(const std::string&, const rapidjson::Value&));
+
+	///Call the subscribers for one user, or for all users if \p globusID is empty
+	void notify(const std::string& globusID);
+	///Call the observers for a change to one user, or for all users if 
+	///\p globusID is empty
+	void notifyObservers(const std::string& globusID);
+
+	void replacePods(const rapidjson::Value& items);
+	void updatePod(const std::string& type, const rapidjson::Value& pod);
+	void replaceServices(const rapidjson::Value& items);
+	void updateService(const std::string& type, const rapidjson::Value& service);
+};
+
+///\return the ID of the user owning a sandbox, based on the value of the app 
+///        label used by its pods and selected by its service, or an empty 
+///        string if the label does not belong to a sandbox
+std::string userFromAppLabel(const std::string& app);
+
+#endif //SLATE_CLUSTERSTATE_H
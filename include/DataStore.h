@@ -0,0 +1,181 @@
+#ifndef SLATE_DATASTORE_H
+#define SLATE_DATASTORE_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <boost/optional.hpp>
+#include <boost/serialization/nvp.hpp>
+#include <boost/serialization/version.hpp>
+
+#include <libcuckoo/cuckoohash_map.hh>
+
+///Everything the spawner remembers about one user's sandbox
+struct UserData{
+	std::string deploymentName;
+	std::string podName;
+	std::string serviceName;
+	unsigned int servicePort;
+	std::string secretName;
+	std::string authToken;
+	std::string slateID;
+	std::string slateToken;
+	///Whether the account has been deleted, and the record is only kept until 
+	///the account's sandbox and SLATE user have been cleaned up
+	bool deleting=false;
+	///Whether the account's deployment has been scaled to zero because the 
+	///sandbox was not being used, in which case the account has no pod
+	bool suspended=false;
+
+	template<typename Archive>
+	void serialize(Archive& ar, const unsigned int file_version);
+};
+
+template<typename Archive>
+void UserData::serialize(Archive& ar, const unsigned int file_version){
+	using boost::serialization::make_nvp;
+	ar & make_nvp("deployment",deploymentName);
+	ar & make_nvp("pod",podName);
+	ar & make_nvp("service",serviceName);
+	ar & make_nvp("port",servicePort);
+	ar & make_nvp("secret",secretName);
+	ar & make_nvp("auth",authToken);
+	ar & make_nvp("slateID",slateID);
+	ar & make_nvp("slateToken",slateToken);
+	if(file_version>=1)
+		ar & make_nvp("deleting",deleting);
+	if(file_version>=2)
+		ar & make_nvp("suspended",suspended);
+}
+BOOST_CLASS_VERSION(UserData,2)
+
+///The persistent collection of user records.
+///
+///Each change is appended to a journal as a single framed, checksummed entry,
+///so the cost of a change does not depend on the number of accounts. A
+///background thread periodically folds the journal into a snapshot of all
+///records, which is what the data file contains. On startup the snapshot is
+///read and then the journal is replayed on top of it.
+///
+///The records are kept in a concurrent hash table, so lookups only contend
+///with changes to the same bucket, and never wait for the journal to be
+///written.
+class DataStore{
+public:
+	///\param dataPath the path of the snapshot file. The journal is kept
+	///                beside it, with the suffix '.journal'.
+	///\param syncInterval if zero, every change is flushed to disk before
+	///                    record() or remove() returns, with concurrent changes
+	///                    sharing flushes. Otherwise, the number of
+	///                    milliseconds between flushes made in the background;
+	///                    changes made since the last flush may be lost if the
+	///                    machine crashes.
+	///\param compactionThreshold the number of journal entries after which the
+	///                           journal is folded into the snapshot
+	DataStore(const std::string& dataPath, unsigned int syncInterval=0,
+	          unsigned int compactionThreshold=1000);
+	///Stops the background thread, and flushes the journal
+	~DataStore();
+
+	DataStore(const DataStore&)=delete;
+	DataStore& operator=(const DataStore&)=delete;
+
+	boost::optional<UserData> find(const std::string& globusID);
+
+	///Store the record for a user, replacing any existing record
+	///\throws std::runtime_error if the change cannot be written to the journal
+	void record(const std::string& globusID, const UserData& data);
+
+	///Change the record for a user, without any other change to the same 
+	///store being made between reading the record and writing it back
+	///\param change a function which modifies the record, and returns whether 
+	///              it did so. It is called with a lock held, so it must be 
+	///              quick and must not use the store. 
+	///\return whether there was a record and it was changed
+	///\throws std::runtime_error if the change cannot be written to the journal
+	bool update(const std::string& globusID, const std::function<bool(UserData&)>& change);
+
+	///Delete the record for a user, if there is one
+	///\throws std::runtime_error if the change cannot be written to the journal
+	void remove(const std::string& globusID);
+
+	///\return a copy of all records, indexed by user
+	std::map<std::string,UserData> records();
+
+	///\return whether any saved data (a snapshot or a journal) was found at 
+	///        startup. If not, the store started empty, which may mean that 
+	///        the data file is missing rather than that there are no users. 
+	bool foundSavedData() const{ return savedDataFound; }
+
+private:
+	///Held by changes, so that the journal and the records agree about the
+	///order in which changes happened, and guards the journal file and the
+	///counters describing it. Lookups do not need it.
+	std::mutex mut;
+	std::string persistentPath;
+	std::string journalPath;
+	///The journal being folded into the snapshot by a compaction which is in
+	///progress, or which failed
+	std::string oldJournalPath;
+	cuckoohash_map<std::string,UserData> podMap;
+
+	int journalFD;
+	///The size of the journal, up to the end of the last complete entry
+	std::size_t journalSize;
+	///The number of entries in the journal
+	std::size_t journalEntries;
+	///Whether oldJournalPath exists
+	bool oldJournalPresent;
+	///Whether a snapshot or journal was read at startup
+	bool savedDataFound;
+	///The sequence number of the last entry appended to the journal
+	std::uint64_t appendedSeq;
+
+	///Held while flushing the journal; acquired before mut when both are needed
+	std::mutex syncMut;
+	///The sequence number of the last entry known to be on disk
+	std::uint64_t syncedSeq;
+
+	const unsigned int syncInterval;
+	const unsigned int compactionThreshold;
+
+	std::mutex maintenanceMut;
+	std::condition_variable maintenanceCond;
+	bool stopMaintenance;
+	bool compactionRequested;
+	std::thread maintenanceThread;
+
+	///Read the snapshot and replay the journal(s)
+	void loadData();
+	///Apply the entries in a journal file to a set of records
+	///\param path the journal to read
+	///\param records the records to update
+	///\param entries the number of valid entries found
+	///\return the size of the valid prefix of the file
+	std::size_t replay(const std::string& path, std::map<std::string,UserData>& records,
+	                   std::size_t& entries);
+	///Open the journal for appending
+	///\pre mut held
+	void openJournal();
+	///Append an entry to the journal
+	///\pre mut held
+	///\return the sequence number of the entry
+	std::uint64_t append(const std::string& payload);
+	///Ensure that the journal is on disk at least up to a given entry
+	void syncJournal(std::uint64_t seq);
+	///Wait for the changes made by the calling thread to be durable, if the
+	///store is configured to make callers wait
+	void changed(std::uint64_t seq);
+	///Rotate the journal and write all records to a new snapshot
+	void compact();
+	///The body of the background thread, which runs periodic flushes and
+	///compactions
+	void maintain();
+};
+
+#endif //SLATE_DATASTORE_H
@@ -0,0 +1,55 @@
+#ifndef SLATE_ENDPOINTCACHE_H
+#define SLATE_ENDPOINTCACHE_H
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include <boost/optional.hpp>
+
+///Where a user's sandbox can be reached
+struct Endpoint{
+	///The pod for which the endpoint was determined
+	std::string podName;
+	///The address of the node on which the pod is running
+	std::string hostIP;
+	///The node port of the user's service
+	unsigned int nodePort;
+};
+
+///Remembers users' sandbox endpoints for a limited time, since they change
+///only when a pod is replaced or a service is recreated. Entries should also
+///be invalidated when such changes are observed.
+class EndpointCache{
+public:
+	///\param ttl how long an entry remains usable after it is stored. If zero,
+	///           nothing is cached.
+	explicit EndpointCache(std::chrono::seconds ttl);
+
+	EndpointCache(const EndpointCache&)=delete;
+	EndpointCache& operator=(const EndpointCache&)=delete;
+
+	///\param globusID the ID of the user owning the sandbox
+	///\return the user's endpoint, or nothing if it is not known or has expired
+	boost::optional<Endpoint> find(const std::string& globusID);
+	///Remember a user's endpoint, replacing any earlier entry
+	void store(const std::string& globusID, const Endpoint& endpoint);
+	///Forget a user's endpoint
+	void invalidate(const std::string& globusID);
+	///Forget all endpoints
+	void clear();
+
+private:
+	typedef std::chrono::steady_clock clock;
+	struct Entry{
+		Endpoint endpoint;
+		clock::time_point expires;
+	};
+
+	const std::chrono::seconds ttl;
+	std::mutex mut;
+	std::map<std::string,Entry> entries;
+};
+
+#endif //SLATE_ENDPOINTCACHE_H
@@ -1,17 +1,33 @@
 #ifndef SLATE_HTTPREQUESTS_H
 #define SLATE_HTTPREQUESTS_H
 
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+
 ///Trivial HTTP(S) request wrappers around libcurl. 
 namespace httpRequests{
 
 struct Options{
 	Options():contentType("application/octet-stream"){}
 	///value to use for the HTTP ContentType header.
-	///Only meaningful for POST and PUT operations
+	///Only meaningful for POST, PUT, and PATCH operations
 	std::string contentType;
 	///If non-empty, the value to set as curl's CURLOPT_CAINFO for SSL 
 	///certificate verification. 
 	std::string caBundlePath;
+	///If non-empty, the path to a PEM client certificate to present to the 
+	///server (CURLOPT_SSLCERT)
+	std::string clientCertPath;
+	///If non-empty, the path to the PEM private key for the client certificate 
+	///(CURLOPT_SSLKEY)
+	std::string clientKeyPath;
+	///If non-empty, a token to send in an 'Authorization: Bearer' header
+	std::string bearerToken;
+	///If non-zero, the maximum time in seconds which the request may take
+	long timeout=0;
 };
 	
 ///The result of an HTTP(S) request
@@ -22,6 +38,102 @@ struct Response{
 	std::string body;
 };
 	
+///Settings which govern how a Client reuses and limits connections
+struct ClientOptions{
+	///The maximum number of requests which may be in progress to any one host 
+	///(scheme, host name, and port) at the same time. Further requests wait 
+	///for one to finish. Streaming requests are not counted. Zero means no 
+	///limit. 
+	unsigned int maxRequestsPerHost=0;
+	///The maximum number of curl handles to keep for reuse once their 
+	///requests have finished
+	unsigned int maxIdleHandles=16;
+	///If non-zero, the number of seconds a connection may be idle before TCP 
+	///keep-alive probes are sent on it
+	long keepAliveIdle=60;
+};
+
+///Makes HTTP(S) requests with a pool of reusable curl handles. Each handle 
+///keeps its connections open between requests, and a request is given a 
+///handle which last talked to the same server if one is idle, so consecutive 
+///requests to a server, even from different threads, usually reuse an 
+///existing connection. The handles share a cache of DNS results and TLS 
+///sessions, so a new connection can skip a full handshake. A Client may be 
+///used from any number of threads at once. 
+class Client{
+public:
+	explicit Client(const ClientOptions& options={});
+	~Client();
+	
+	Client(const Client&)=delete;
+	Client& operator=(const Client&)=delete;
+	
+	///Make an HTTP(S) GET request
+	Response get(const std::string& url, const Options& options={}) const;
+	///Make an HTTP(S) DELETE request
+	Response del(const std::string& url, const Options& options={}) const;
+	///Make an HTTP(S) DELETE request with a body
+	Response del(const std::string& url, const std::string& body, 
+	             const Options& options={}) const;
+	///Make an HTTP(S) PUT request
+	Response put(const std::string& url, const std::string& body, 
+	             const Options& options={}) const;
+	///Make an HTTP(S) POST request
+	Response post(const std::string& url, const std::string& body, 
+	              const Options& options={}) const;
+	///Make an HTTP(S) PATCH request
+	Response patch(const std::string& url, const std::string& body, 
+	               const Options& options={}) const;
+	///Make an HTTP(S) GET request whose body is passed to a callback as it 
+	///arrives. See httpGetStreaming. 
+	Response getStreaming(const std::string& url, 
+	                      const std::function<bool(const char*,std::size_t)>& consumer, 
+	                      const Options& options={}) const;
+	
+private:
+	struct Pool;
+	std::unique_ptr<Pool> pool;
+};
+
+///Makes HTTP(S) requests without blocking the caller. All transfers are 
+///driven by a single background thread using libcurl's multi interface, and 
+///their results are delivered through futures. At most a fixed number of 
+///transfers run at once; further requests wait in a queue. The curl handles 
+///of finished transfers are reused, and the connections they opened are kept 
+///for later transfers to the same servers. 
+class AsyncClient{
+public:
+	///\param maxInFlight the maximum number of transfers to run at the same 
+	///                   time
+	explicit AsyncClient(unsigned int maxInFlight=8);
+	///Stops the background thread. Requests which have not completed fail. 
+	~AsyncClient();
+	
+	AsyncClient(const AsyncClient&)=delete;
+	AsyncClient& operator=(const AsyncClient&)=delete;
+	
+	///Start an HTTP(S) GET request
+	///\return a future for the response. If the transfer fails the future 
+	///        holds a std::runtime_error. 
+	std::future<Response> get(const std::string& url, const Options& options={});
+	///Start an HTTP(S) DELETE request
+	std::future<Response> del(const std::string& url, const Options& options={});
+	///Start an HTTP(S) POST request
+	std::future<Response> post(const std::string& url, const std::string& body, 
+	                           const Options& options={});
+	
+private:
+	struct Engine;
+	std::unique_ptr<Engine> engine;
+};
+
+///Set the options of the client used by the free request functions below. 
+///This must be called before any requests are made to have an effect. 
+void configureDefaultClient(const ClientOptions& options);
+
+///\return the client used by the free request functions
+const Client& defaultClient();
+
 ///Make an HTTP(S) GET request
 ///\param url the URL to request
 Response httpGet(const std::string& url, const Options& options={});
@@ -29,6 +141,12 @@ Response httpGet(const std::string& url, const Options& options={});
 ///Make an HTTP(S) DELETE request
 ///\param url the URL to request
 Response httpDelete(const std::string& url, const Options& options={});
+
+///Make an HTTP(S) DELETE request with a body
+///\param url the URL to request
+///\param body the data to send as the body of the request
+Response httpDelete(const std::string& url, const std::string& body, 
+                    const Options& options={});
 	
 ///Make an HTTP(S) PUT request
 ///\param url the URL to request
@@ -44,6 +162,28 @@ Response httpPut(const std::string& url, const std::string& body,
 Response httpPost(const std::string& url, const std::string& body, 
                   const Options& options={});
 	
+///Make an HTTP(S) PATCH request
+///\param url the URL to request
+///\param body the data to send as the body of the request
+///\param contentType the value to use for the HTTP ContentType header
+Response httpPatch(const std::string& url, const std::string& body, 
+                   const Options& options={});
+	
+///Make an HTTP(S) GET request, passing the response body to a callback as it 
+///arrives rather than collecting it. This is suitable for long-lived streams. 
+///\param url the URL to request
+///\param consumer the function to which each piece of the body is passed. If 
+///                it returns false the transfer is stopped. It is not called 
+///                with data if the server reports an error, in which case 
+///                the body is collected in the Response as usual. While the 
+///                stream is idle it is also called with no data about once a 
+///                second, so that it can stop the transfer promptly. 
+///\return the response, whose body will be empty unless an error status was 
+///        returned
+Response httpGetStreaming(const std::string& url, 
+                          const std::function<bool(const char*,std::size_t)>& consumer, 
+                          const Options& options={});
+	
 }
 
 #endif //SLATE_HTTPREQUESTS_H
\ No newline at end of file
@@ -0,0 +1,140 @@
+#ifndef SLATE_JOBS_H
+#define SLATE_JOBS_H
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+///A unit of background work which proceeds through a fixed sequence of named
+///stages, and whose progress can be inspected while it runs
+class Job{
+public:
+	enum class State{Queued, Running, Succeeded, Failed};
+	enum class StageState{Pending, Running, Done, Skipped, Failed};
+
+	///\param id a unique identifier for the job
+	///\param key the name of the thing on which the job operates
+	///\param stages the names of the job's stages, in the order they run
+	///\param detail information to be shared with anyone who joins the job
+	Job(const std::string& id, const std::string& key, const std::vector<std::string>& stages,
+	    const std::string& detail="");
+
+	const std::string& id() const{ return id_; }
+	const std::string& key() const{ return key_; }
+	const std::string& detail() const{ return detail_; }
+
+	///Run one stage of the job, recording when it starts and finishes
+	///\param name the name of the stage, which must be one of those given to
+	///            the constructor
+	///\param work the work of the stage. If it throws the stage is recorded as
+	///            failed and the exception is propagated.
+	void runStage(const std::string& name, const std::function<void()>& work);
+	///Record that a stage was not needed
+	///\param reason an explanation to report with the stage
+	void skipStage(const std::string& name, const std::string& reason="");
+	///Attach a message to a stage, e.g. to explain how it was carried out
+	void describeStage(const std::string& name, const std::string& message);
+
+	State state() const;
+	///\return whether the job is queued or running
+	bool inProgress() const;
+	///\return the job's status as a JSON object, including the state and
+	///        timing of each stage
+	std::string statusJSON() const;
+
+private:
+	typedef std::chrono::steady_clock clock;
+	struct Stage{
+		std::string name;
+		StageState state;
+		clock::time_point started;
+		clock::time_point finished;
+		std::string message;
+	};
+
+	const std::string id_;
+	const std::string key_;
+	const std::string detail_;
+	mutable std::mutex mut;
+	State state_;
+	clock::time_point created;
+	clock::time_point finished;
+	std::string error;
+	std::vector<Stage> stages;
+
+	///\pre mut held
+	Stage& findStage(const std::string& name);
+	void setState(State state, const std::string& error="");
+
+	friend class JobQueue;
+};
+
+///A pool of worker threads which run jobs in the order they are submitted,
+///and a table of recent jobs indexed by key
+class JobQueue{
+public:
+	///\param workers the number of jobs which may run at the same time
+	///\param retention how long the table should remember a job after it
+	///                 finishes
+	explicit JobQueue(unsigned int workers,
+	                  std::chrono::seconds retention=std::chrono::seconds(600));
+	///Stops the workers. Jobs which have not started are abandoned.
+	~JobQueue();
+
+	JobQueue(const JobQueue&)=delete;
+	JobQueue& operator=(const JobQueue&)=delete;
+
+	///Queue a job, unless a job with the same key is already queued or
+	///running, in which case that job is returned instead, so that concurrent
+	///requests for the same thing share one job. A new job replaces any
+	///earlier, finished job with the same key in the table.
+	///\param key the name of the thing on which the job operates
+	///\param stages the names of the job's stages, in the order they run
+	///\param work the function which carries out the job. The job fails if it
+	///            throws, and succeeds otherwise.
+	///\param detail information to be shared with callers which join the job
+	///\param joined if not null, set to whether an existing job was returned
+	///\return the new or existing job
+	std::shared_ptr<Job> submit(const std::string& key, const std::vector<std::string>& stages,
+	                            std::function<void(Job&)> work, const std::string& detail="",
+	                            bool* joined=nullptr);
+
+	///\return the most recent job with the given key, if it is still
+	///        remembered
+	std::shared_ptr<Job> find(const std::string& key) const;
+
+	///\return whether a job with the given key is queued or running
+	bool inProgress(const std::string& key) const;
+
+	///Remove the record of the most recent job with a given key
+	void forget(const std::string& key);
+
+private:
+	struct Task{
+		std::shared_ptr<Job> job;
+		std::function<void(Job&)> work;
+	};
+
+	const std::chrono::seconds retention;
+	mutable std::mutex mut;
+	std::condition_variable cond;
+	bool stop;
+	std::deque<Task> queue;
+	std::map<std::string,std::shared_ptr<Job>> jobs;
+	unsigned long long nextID;
+	std::vector<std::thread> workers;
+
+	void work();
+	///Remove finished jobs which are older than the retention time
+	///\pre mut held
+	void prune();
+};
+
+#endif //SLATE_JOBS_H
@@ -0,0 +1,202 @@
+#ifndef SLATE_KUBERNETES_H
+#define SLATE_KUBERNETES_H
+
+#include <functional>
+#include <string>
+
+#include "rapidjson/document.h"
+
+#include "HTTPRequests.h"
+
+///A minimal in-process client for the Kubernetes REST API, used in place of
+///running kubectl.
+namespace kubernetes{
+
+///The information needed to connect and authenticate to an API server
+struct Config{
+	///The base URL of the API server, e.g. https://10.0.0.1:6443
+	std::string server;
+	///If non-empty, a bearer token with which to authenticate
+	std::string token;
+	///If non-empty, the path to the CA certificate(s) used to verify the server
+	std::string caBundlePath;
+	///If non-empty, the path to a client certificate with which to authenticate
+	std::string clientCertPath;
+	///If non-empty, the path to the private key for the client certificate
+	std::string clientKeyPath;
+};
+
+///Determine how to connect to the API server, in the same way as kubectl.
+///\param kubeconfigPath the kubeconfig file to use. If empty, $KUBECONFIG is
+///                      used if set, then ~/.kube/config if it exists, and
+///                      finally the in-cluster service account if running in
+///                      a pod.
+///\throws std::runtime_error if no usable configuration can be found
+Config loadConfig(const std::string& kubeconfigPath="");
+
+///The kinds of objects which the client knows how to address
+enum class Kind{Pod, Service, Deployment, Secret};
+
+///\return the Kind corresponding to a manifest 'kind' field
+///\throws std::runtime_error if the kind is not one which is supported
+Kind kindFromString(const std::string& kind);
+
+///Extract the human-readable message from a failed API response
+///\param response the response, whose body is expected to be a Status object
+///\return the message from the Status, or the raw body if it cannot be parsed
+std::string errorMessage(const httpRequests::Response& response);
+
+class Client{
+public:
+	explicit Client(const Config& config);
+
+	///Fetch a single object
+	///\param kind the kind of the object
+	///\param ns the namespace containing the object
+	///\param name the name of the object
+	///\return the API response, with a body which is the JSON object on success
+	///\throws std::runtime_error if \p name is empty
+	httpRequests::Response get(Kind kind, const std::string& ns, const std::string& name) const;
+
+	///Fetch all objects of a kind in a namespace
+	///\param kind the kind of objects to list
+	///\param ns the namespace to search
+	///\param labelSelector if non-empty, a selector which objects must match
+	///\return the API response, with a body which is the JSON list on success
+	httpRequests::Response list(Kind kind, const std::string& ns, const std::string& labelSelector="") const;
+
+	///Create an object
+	///\param kind the kind of the object
+	///\param ns the namespace in which to create the object
+	///\param manifest the object definition, as JSON or YAML
+	///\return the API response, with a body which is the created object on success
+	httpRequests::Response create(Kind kind, const std::string& ns, const std::string& manifest) const;
+
+	///Modify an existing object
+	///\param kind the kind of the object
+	///\param ns the namespace containing the object
+	///\param name the name of the object
+	///\param patch the changes to make
+	///\param patchType the content type identifying how \p patch is to be 
+	///                 interpreted
+	///\return the API response, with a body which is the modified object on 
+	///        success
+	///\throws std::runtime_error if \p name is empty
+	httpRequests::Response patch(Kind kind, const std::string& ns, const std::string& name, 
+	                             const std::string& patch, 
+	                             const std::string& patchType="application/merge-patch+json") const;
+
+	///Create or update an object using server-side apply, so that the server 
+	///merges \p manifest into any existing object rather than rejecting it
+	///\param kind the kind of the object
+	///\param ns the namespace of the object
+	///\param name the name of the object, which must match the manifest
+	///\param manifest the complete desired object definition, as JSON or YAML
+	///\param fieldManager the name under which the server records ownership 
+	///                    of the fields set by \p manifest. Conflicts with 
+	///                    other managers are resolved in favour of this one.
+	///\return the API response, with status 201 if the object was created or 
+	///        200 if it was updated, and a body which is the resulting object
+	///\throws std::runtime_error if \p name is empty
+	httpRequests::Response apply(Kind kind, const std::string& ns, const std::string& name, 
+	                             const std::string& manifest, 
+	                             const std::string& fieldManager="sandbox-spawner") const;
+	
+	///Delete an object
+	///\param kind the kind of the object
+	///\param ns the namespace containing the object
+	///\param name the name of the object
+	///\param propagationPolicy if non-empty, how the object's dependents are to 
+	///                         be deleted: "Foreground", "Background", or 
+	///                         "Orphan". Otherwise the server's default for 
+	///                         the kind is used.
+	///\param uid if non-empty, the UID which the object must have, so that an 
+	///           object which has been replaced by another of the same name 
+	///           since it was looked up is left alone (the server then 
+	///           responds with status 409)
+	///\throws std::runtime_error if \p name is empty
+	httpRequests::Response remove(Kind kind, const std::string& ns, const std::string& name, 
+	                              const std::string& propagationPolicy="", 
+	                              const std::string& uid="") const;
+
+	///Watch for changes to objects of a kind in a namespace. Returns when the 
+	///server ends the watch (after at most \p timeout seconds), the connection 
+	///fails, or the handler returns false. 
+	///\param kind the kind of objects to watch
+	///\param ns the namespace to watch
+	///\param labelSelector if non-empty, a selector which objects must match
+	///\param resourceVersion the version after which changes are of interest, 
+	///                       normally that returned by a list or by the last 
+	///                       event seen
+	///\param handler the function called with the type ("ADDED", "MODIFIED", 
+	///               "DELETED", "BOOKMARK", or "ERROR") and object of each event
+	///\param timeout the number of seconds after which the server should end 
+	///               the watch
+	///\param stopped if set, a function checked about once a second, and 
+	///               whenever an event arrives, which ends the watch early by 
+	///               returning true
+	///\return the API response, which has an empty body unless the watch could 
+	///        not be started
+	httpRequests::Response watch(Kind kind, const std::string& ns, const std::string& labelSelector, 
+	                             const std::string& resourceVersion, 
+	                             const std::function<bool(const std::string&, const rapidjson::Value&)>& handler, 
+	                             unsigned int timeout=300, 
+	                             const std::function<bool()>& stopped=nullptr) const;
+
+	///Apply all objects defined in a YAML manifest, which may contain multiple
+	///documents. This is the in-memory equivalent of 
+	///`kubectl apply --server-side -f`.
+	///\return the response to the first application which failed, or to the 
+	///        last application if all succeeded
+	httpRequests::Response applyAll(const std::string& manifests) const;
+
+	httpRequests::Response getPod(const std::string& ns, const std::string& name) const{
+		return get(Kind::Pod,ns,name);
+	}
+	httpRequests::Response getService(const std::string& ns, const std::string& name) const{
+		return get(Kind::Service,ns,name);
+	}
+	httpRequests::Response getDeployment(const std::string& ns, const std::string& name) const{
+		return get(Kind::Deployment,ns,name);
+	}
+	httpRequests::Response getSecret(const std::string& ns, const std::string& name) const{
+		return get(Kind::Secret,ns,name);
+	}
+	httpRequests::Response listPods(const std::string& ns, const std::string& labelSelector="") const{
+		return list(Kind::Pod,ns,labelSelector);
+	}
+	httpRequests::Response patchPod(const std::string& ns, const std::string& name, const std::string& patch) const{
+		return this->patch(Kind::Pod,ns,name,patch);
+	}
+	httpRequests::Response patchDeployment(const std::string& ns, const std::string& name, const std::string& patch) const{
+		return this->patch(Kind::Deployment,ns,name,patch);
+	}
+	httpRequests::Response deletePod(const std::string& ns, const std::string& name) const{
+		return remove(Kind::Pod,ns,name);
+	}
+	httpRequests::Response deleteService(const std::string& ns, const std::string& name) const{
+		return remove(Kind::Service,ns,name);
+	}
+	httpRequests::Response deleteDeployment(const std::string& ns, const std::string& name) const{
+		return remove(Kind::Deployment,ns,name);
+	}
+	httpRequests::Response deleteSecret(const std::string& ns, const std::string& name) const{
+		return remove(Kind::Secret,ns,name);
+	}
+
+private:
+	///The base URL of the API server, without a trailing slash
+	std::string server;
+	///Authentication and verification settings applied to every request
+	httpRequests::Options baseOptions;
+
+	///Construct the URL for a collection of objects, or a single object
+	///\param kind the kind of the object(s)
+	///\param ns the namespace of the object(s)
+	///\param name the name of a single object, or empty for the collection
+	std::string objectURL(Kind kind, const std::string& ns, const std::string& name="") const;
+};
+
+} //namespace kubernetes
+
+#endif //SLATE_KUBERNETES_H
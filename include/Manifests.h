@@ -0,0 +1,176 @@
+#ifndef SLATE_MANIFESTS_H
+#define SLATE_MANIFESTS_H
+
+#include <string>
+#include <vector>
+
+//The built-in templates of the manifests from which users' objects and the 
+//warm pool are created. Each may be replaced by a file; see ManifestTemplates. 
+
+//The placeholders which may appear in the secret, deployment and service 
+//templates
+const static std::vector<std::string> accountPlaceholders={"name","auth","external-port","slate-token","slate-endpoint"};
+const static std::string secretTemplate=R"(apiVersion: v1
+kind: Secret
+metadata:
+  name: {{name}}-slate-data
+  namespace: tutorial
+type: Opaque
+data:
+  token: {{slate-token}}
+  endpoint: {{slate-endpoint}}
+)";
+const static std::string deploymentTemplate=R"(apiVersion: apps/v1
+kind: Deployment
+metadata:
+  name: {{name}}
+  namespace: tutorial
+  labels:
+    app: {{name}}
+spec:
+  replicas: 1
+  selector:
+    matchLabels:
+      app: {{name}}
+  template:
+    metadata:
+      labels:
+        app: {{name}}
+    spec:
+      hostname: sandbox
+      containers:
+      - name: {{name}}
+        image: slateci/container-ttyd
+        command: ["ttyd"]
+        args: ["-u","999","-g","999","--ssl","--ssl-cert","/opt/ttyd/cert1.pem","--ssl-key","/opt/ttyd/privkey1.pem","-c","{{auth}}","bash"]
+        imagePullPolicy: Always
+        ports:
+        - containerPort: 7681
+          name: ttyd
+        volumeMounts:
+        - name: server-certificate
+          mountPath: "/opt/ttyd"
+        - name: slate-client
+          mountPath: "/usr/local/bin/slate"
+        env:
+          - name: SLATE_API_ENDPOINT
+            valueFrom:
+              secretKeyRef:
+                name: {{name}}-slate-data
+                key: endpoint
+          - name: SLATE_TOKEN
+            valueFrom:
+              secretKeyRef:
+                name: {{name}}-slate-data
+                key: token
+      volumes:
+      - name: server-certificate
+        secret:
+          secretName: server-certificate
+          defaultMode: 384 # 0600
+      - name: slate-client
+        hostPath:
+          path: /opt/sandbox-spawner/slate
+          type: File
+)";
+const static std::string serviceTemplate=R"(kind: Service
+apiVersion: v1
+metadata:
+  name: {{name}}-service
+  namespace: tutorial
+spec:
+  selector:
+    app: {{name}}
+  type: "NodePort"
+  ports:
+  - protocol: TCP
+    port: {{external-port}} # external port
+    targetPort: 7681 # internal port where the daemon is listening
+)";
+
+//The placeholders which may appear in the pool template
+const static std::vector<std::string> poolPlaceholders={"pool-size","claim-url"};
+//Pool pods start ttyd only once they have been claimed for a user. A pod 
+//polls the spawner for its credentials, proving its identity with its UID, 
+//which is known only to the pod and to those with access to the API server. 
+//The credentials are also added to the pod's annotations, which are visible 
+//inside the pod through the downward API, as a fallback for a claim made 
+//before the spawner restarted: kubelet updates that file only on its periodic 
+//sync of the pod, which can take a minute or more. Until then the readiness 
+//probe keeps the pod from being reported as ready. 
+//(The shell script contains ')"', so this needs a raw string delimiter.)
+const static std::string poolTemplate=R"manifest(apiVersion: apps/v1
+kind: Deployment
+metadata:
+  name: sandbox-pool
+  namespace: tutorial
+  labels:
+    app: sandbox-pool
+spec:
+  replicas: {{pool-size}}
+  selector:
+    matchLabels:
+      app: sandbox-pool
+  template:
+    metadata:
+      labels:
+        app: sandbox-pool
+    spec:
+      hostname: sandbox
+      containers:
+      - name: ttyd
+        image: slateci/container-ttyd
+        command: ["/bin/sh","-c"]
+        args:
+        - |
+          get(){ sed -n "s|^sandbox.slateci.io/$1=\"\(.*\)\"\$|\1|p" /tmp/claim 2>/dev/null; }
+          until { curl -sf -o /tmp/claim "{{claim-url}}/$POD_NAME?uid=$POD_UID" || cp /etc/podinfo/annotations /tmp/claim 2>/dev/null; } && [ -n "$(get auth)" ]; do
+            sleep 0.5
+          done
+          export SLATE_API_ENDPOINT="$(get slate-endpoint | base64 -d)"
+          export SLATE_TOKEN="$(get slate-token | base64 -d)"
+          AUTH="$(get auth)"
+          rm -f /tmp/claim
+          exec ttyd -u 999 -g 999 --ssl --ssl-cert /opt/ttyd/cert1.pem --ssl-key /opt/ttyd/privkey1.pem -c "$AUTH" bash
+        imagePullPolicy: Always
+        env:
+          - name: POD_NAME
+            valueFrom:
+              fieldRef:
+                fieldPath: metadata.name
+          - name: POD_UID
+            valueFrom:
+              fieldRef:
+                fieldPath: metadata.uid
+        ports:
+        - containerPort: 7681
+          name: ttyd
+        readinessProbe:
+          tcpSocket:
+            port: 7681
+          periodSeconds: 1
+        volumeMounts:
+        - name: server-certificate
+          mountPath: "/opt/ttyd"
+        - name: slate-client
+          mountPath: "/usr/local/bin/slate"
+        - name: podinfo
+          mountPath: "/etc/podinfo"
+      volumes:
+      - name: server-certificate
+        secret:
+          secretName: server-certificate
+          defaultMode: 384 # 0600
+      - name: slate-client
+        hostPath:
+          path: /opt/sandbox-spawner/slate
+          type: File
+      - name: podinfo
+        downwardAPI:
+          items:
+          - path: annotations
+            fieldRef:
+              fieldPath: metadata.annotations
+)manifest";
+
+#endif //SLATE_MANIFESTS_H
@@ -0,0 +1,84 @@
+#ifndef SLATE_PORTALLOCATOR_H
+#define SLATE_PORTALLOCATOR_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+///Hands out ports from a configured set of ranges. Ports are tracked in a
+///bitmap which is updated with atomic operations, so reserving and releasing
+///ports never blocks, and concurrent callers never receive the same port.
+class PortAllocator{
+public:
+	///\param ranges a comma separated list of ports and port ranges from which
+	///              to allocate, e.g. "5000-5999,7000-7999"
+	///\param exclusions a comma separated list of ports and port ranges which
+	///                  must not be allocated even though they fall within
+	///                  \p ranges
+	///\throws std::runtime_error if either list cannot be parsed, or no ports
+	///        remain available
+	PortAllocator(const std::string& ranges, const std::string& exclusions="");
+
+	PortAllocator(const PortAllocator&)=delete;
+	PortAllocator& operator=(const PortAllocator&)=delete;
+
+	///Reserve the lowest free port (approximately; with concurrent callers the
+	///search may begin where the last one succeeded)
+	///\return the port, which is now in use until passed to release()
+	///\throws std::runtime_error if all ports are in use
+	unsigned int reserve();
+
+	///Reserve a specific port, for instance one which was allocated before a
+	///restart
+	///\return whether the port was free and could be reserved
+	bool claim(unsigned int port);
+
+	///Return a port to the pool. Ports which could not have been reserved are
+	///ignored.
+	void release(unsigned int port);
+
+	///\return the number of ports currently free
+	std::size_t available() const;
+
+private:
+	///The port corresponding to the first bit of the bitmap
+	unsigned int base;
+	///The number of ports covered by the bitmap
+	std::size_t span;
+	std::size_t wordCount;
+	///One bit per port, set if the port is in use or is not allowed
+	std::unique_ptr<std::atomic<std::uint64_t>[]> used;
+	///One bit per port, set if the port may ever be allocated
+	std::unique_ptr<std::uint64_t[]> allowed;
+	///The word in which to begin the next search
+	std::atomic<std::size_t> hint;
+};
+
+///A port reserved from an allocator which is released again when the
+///reservation is destroyed, unless it has been kept
+class PortReservation{
+public:
+	///Reserve a port
+	///\throws std::runtime_error if all ports are in use
+	explicit PortReservation(PortAllocator& allocator):
+	allocator(allocator),port_(allocator.reserve()),kept(false){}
+	~PortReservation(){
+		if(!kept)
+			allocator.release(port_);
+	}
+
+	PortReservation(const PortReservation&)=delete;
+	PortReservation& operator=(const PortReservation&)=delete;
+
+	unsigned int port() const{ return port_; }
+	///Keep the port reserved after this object is destroyed
+	void keep(){ kept=true; }
+
+private:
+	PortAllocator& allocator;
+	const unsigned int port_;
+	bool kept;
+};
+
+#endif //SLATE_PORTALLOCATOR_H
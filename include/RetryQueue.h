@@ -0,0 +1,59 @@
+#ifndef SLATE_RETRYQUEUE_H
+#define SLATE_RETRYQUEUE_H
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+///Drives tasks, identified by key, to completion in the background. A task
+///which fails is tried again after a delay which doubles with each failure, so
+///the task must be safe to repeat.
+class RetryQueue{
+public:
+	///The work to be done for a key. Failure is signalled by throwing.
+	typedef std::function<void(const std::string&)> Task;
+
+	///\param task the function to run for each key
+	///\param workers the number of keys which may be worked on at the same time
+	///\param minDelay the delay before the first retry
+	///\param maxDelay the longest delay between retries
+	RetryQueue(Task task, unsigned int workers,
+	           std::chrono::seconds minDelay=std::chrono::seconds(1),
+	           std::chrono::seconds maxDelay=std::chrono::seconds(300));
+	///Stops the workers. Tasks which have not completed are abandoned.
+	~RetryQueue();
+
+	RetryQueue(const RetryQueue&)=delete;
+	RetryQueue& operator=(const RetryQueue&)=delete;
+
+	///Run the task for a key as soon as a worker is free, unless it is already
+	///queued, waiting to be retried, or running
+	void add(const std::string& key);
+
+	///\return the number of keys whose tasks have not yet succeeded
+	std::size_t pending() const;
+
+private:
+	typedef std::chrono::steady_clock clock;
+
+	const Task task;
+	const std::chrono::seconds minDelay;
+	const std::chrono::seconds maxDelay;
+	mutable std::mutex mut;
+	std::condition_variable cond;
+	bool stop;
+	///keys due to be run, indexed by when
+	std::multimap<clock::time_point,std::string> schedule;
+	///all keys which have not succeeded, with the delay to use if they fail
+	std::map<std::string,std::chrono::seconds> delays;
+	std::vector<std::thread> workers;
+
+	void work();
+};
+
+#endif //SLATE_RETRYQUEUE_H
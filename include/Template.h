@@ -0,0 +1,52 @@
+#ifndef SLATE_TEMPLATE_H
+#define SLATE_TEMPLATE_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+///A piece of text containing placeholders of the form {{name}}, where a name 
+///consists of lower case letters, digits and dashes. The text is parsed once, 
+///into literal segments and placeholder slots, so that it can then be 
+///rendered repeatedly in a single pass. Text between braces which does not 
+///have the form of a placeholder is treated literally. 
+class Template{
+public:
+	///Construct an empty template
+	Template(){}
+	///\param text the text of the template
+	explicit Template(std::string text);
+	
+	///Read a template from a file
+	///\param path the path to the file
+	///\throws std::runtime_error if the file cannot be read
+	static Template load(const std::string& path);
+	
+	///Substitute values for all of the template's placeholders
+	///\param values the values of the placeholders, indexed by name
+	///\return the rendered text
+	///\throws std::runtime_error if the template contains a placeholder for 
+	///        which no value is given
+	std::string render(const std::map<std::string,std::string>& values) const;
+	
+	///\return the names of the placeholders which appear in the template, 
+	///        each listed once
+	const std::vector<std::string>& placeholders() const{ return slots; }
+	
+private:
+	///A run of literal text, followed by a placeholder
+	struct Segment{
+		///The position of the literal text within the template's text
+		std::size_t offset;
+		std::size_t length;
+		///The index in slots of the placeholder which follows the literal text, 
+		///or -1 for the last segment
+		int slot;
+	};
+	
+	std::string text;
+	std::vector<Segment> segments;
+	std::vector<std::string> slots;
+};
+
+#endif //SLATE_TEMPLATE_H
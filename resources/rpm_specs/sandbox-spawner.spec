@@ -7,8 +7,8 @@ URL: https://github.com/slateci/sandbox-spawner
 
 Source0: %{name}-%{version}.tar.gz
 
-BuildRequires: gcc-c++ boost-devel zlib-devel openssl-devel libcurl-devel cmake3
-Requires: boost zlib openssl libcurl
+BuildRequires: gcc-c++ boost-devel zlib-devel openssl-devel libcurl-devel yaml-cpp-devel cmake3
+Requires: boost zlib openssl libcurl yaml-cpp
 
 %description
 SLATE Sandbox Spawner
@@ -0,0 +1,356 @@
+#include "ClusterState.h"
+
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+namespace{
+	const std::string appPrefix="ttyd-";
+	
+	///\return the value of a label, or the empty string if it is not set
+	std::string getLabel(const rapidjson::Value& object, const char* label){
+		if(!object.HasMember("metadata") || !object["metadata"].IsObject())
+			return "";
+		const rapidjson::Value& metadata=object["metadata"];
+		if(!metadata.HasMember("labels") || !metadata["labels"].IsObject())
+			return "";
+		const rapidjson::Value& labels=metadata["labels"];
+		if(!labels.HasMember(label) || !labels[label].IsString())
+			return "";
+		return labels[label].GetString();
+	}
+	
+	///\return the value of the app label selected by a service, or the empty 
+	///        string if there is none
+	std::string getSelectedApp(const rapidjson::Value& service){
+		if(!service.HasMember("spec") || !service["spec"].IsObject())
+			return "";
+		const rapidjson::Value& spec=service["spec"];
+		if(!spec.HasMember("selector") || !spec["selector"].IsObject())
+			return "";
+		const rapidjson::Value& selector=spec["selector"];
+		if(!selector.HasMember("app") || !selector["app"].IsString())
+			return "";
+		return selector["app"].GetString();
+	}
+	
+	std::string getResourceVersion(const rapidjson::Value& object){
+		if(!object.HasMember("metadata") || !object["metadata"].IsObject()
+		   || !object["metadata"].HasMember("resourceVersion") 
+		   || !object["metadata"]["resourceVersion"].IsString())
+			return "";
+		return object["metadata"]["resourceVersion"].GetString();
+	}
+}
+
+std::string userFromAppLabel(const std::string& app){
+	if(app.size()<=appPrefix.size() || app.compare(0,appPrefix.size(),appPrefix)!=0)
+		return "";
+	return app.substr(appPrefix.size());
+}
+
+PodState parsePodState(const rapidjson::Value& pod){
+	if(!pod.IsObject() || !pod.HasMember("metadata") || !pod["metadata"].IsObject()
+	   || !pod["metadata"].HasMember("name") || !pod["metadata"]["name"].IsString())
+		throw std::runtime_error("Pod has no name");
+	PodState state;
+	state.name=pod["metadata"]["name"].GetString();
+	state.ready=false;
+	state.running=false;
+	state.finished=false;
+	state.terminating=pod["metadata"].HasMember("deletionTimestamp");
+	if(!pod.HasMember("status") || !pod["status"].IsObject())
+		return state;
+	const rapidjson::Value& status=pod["status"];
+	if(status.HasMember("phase") && status["phase"].IsString()){
+		const std::string phase=status["phase"].GetString();
+		state.running=(phase=="Running");
+		state.finished=(phase=="Failed" || phase=="Succeeded");
+	}
+	if(status.HasMember("hostIP") && status["hostIP"].IsString())
+		state.hostIP=status["hostIP"].GetString();
+	if(status.HasMember("conditions") && status["conditions"].IsArray()){
+		for(const auto& condition : status["conditions"].GetArray()){
+			if(!condition.HasMember("type") || !condition["type"].IsString()
+			   || !condition.HasMember("status") || !condition["status"].IsString())
+				continue;
+			if(condition["type"].GetString()==std::string("Ready")){
+				//for some reason this is a string?
+				state.ready=(condition["status"].GetString()==std::string("True"));
+				break;
+			}
+		}
+	}
+	return state;
+}
+
+unsigned int parseNodePort(const rapidjson::Value& service){
+	if(!service.IsObject() || !service.HasMember("spec") || !service["spec"].IsObject()
+	   || !service["spec"].HasMember("ports") || !service["spec"]["ports"].IsArray()
+	   || service["spec"]["ports"].Empty())
+		throw std::runtime_error("Service has no ports");
+	const rapidjson::Value& port=service["spec"]["ports"][0];
+	if(!port.HasMember("nodePort") || !port["nodePort"].IsUint())
+		throw std::runtime_error("Service has no node port");
+	return port["nodePort"].GetUint();
+}
+
+ClusterState::ClusterState(const kubernetes::Client& kube, const std::string& ns):
+kube(kube),ns(ns),nextSubscription(0),podsSynced(false),servicesSynced(false),stop(false){}
+
+ClusterState::~ClusterState(){
+	stop.store(true);
+	if(podThread.joinable())
+		podThread.join();
+	if(serviceThread.joinable())
+		serviceThread.join();
+}
+
+void ClusterState::start(){
+	//only pods with an app label can belong to sandboxes
+	podThread=std::thread(&ClusterState::inform,this,kubernetes::Kind::Pod,"app",
+	                      std::ref(podsSynced),&ClusterState::replacePods,&ClusterState::updatePod);
+	//sandbox services have no labels of their own, so they are identified by 
+	//what they select
+	serviceThread=std::thread(&ClusterState::inform,this,kubernetes::Kind::Service,"",
+	                          std::ref(servicesSynced),&ClusterState::replaceServices,&ClusterState::updateService);
+}
+
+bool ClusterState::synced() const{
+	return podsSynced.load() && servicesSynced.load();
+}
+
+boost::optional<PodState> ClusterState::findPod(const std::string& globusID, const std::string& podName) const{
+	std::lock_guard<std::mutex> lock(mut);
+	auto user=pods.find(globusID);
+	if(user==pods.end())
+		return {};
+	auto pod=user->second.find(podName);
+	if(pod==user->second.end())
+		return {};
+	return pod->second;
+}
+
+std::vector<PodState> ClusterState::findPods(const std::string& globusID) const{
+	std::vector<PodState> result;
+	std::lock_guard<std::mutex> lock(mut);
+	auto user=pods.find(globusID);
+	if(user==pods.end())
+		return result;
+	for(const auto& pod : user->second)
+		result.push_back(pod.second);
+	return result;
+}
+
+boost::optional<unsigned int> ClusterState::findNodePort(const std::string& globusID) const{
+	std::lock_guard<std::mutex> lock(mut);
+	auto it=nodePorts.find(globusID);
+	if(it==nodePorts.end())
+		return {};
+	return it->second;
+}
+
+std::size_t ClusterState::subscribe(const std::string& globusID, ChangeCallback callback){
+	std::lock_guard<std::mutex> lock(subscriberMut);
+	std::size_t handle=nextSubscription++;
+	subscribers[globusID].emplace(handle,std::move(callback));
+	return handle;
+}
+
+void ClusterState::unsubscribe(const std::string& globusID, std::size_t handle){
+	std::lock_guard<std::mutex> lock(subscriberMut);
+	auto it=subscribers.find(globusID);
+	if(it==subscribers.end())
+		return;
+	it->second.erase(handle);
+	if(it->second.empty())
+		subscribers.erase(it);
+}
+
+void ClusterState::observe(ObserverCallback observer){
+	std::lock_guard<std::mutex> lock(subscriberMut);
+	observers.push_back(std::move(observer));
+}
+
+void ClusterState::notifyObservers(const std::string& globusID){
+	std::vector<ObserverCallback> callbacks;
+	{
+		std::lock_guard<std::mutex> lock(subscriberMut);
+		callbacks=observers;
+	}
+	for(const auto& callback : callbacks){
+		try{
+			callback(globusID);
+		}catch(std::exception& ex){
+			std::cerr << "Exception in cluster state observer: " << ex.what() << std::endl;
+		}
+	}
+}
+
+void ClusterState::notify(const std::string& globusID){
+	notifyObservers(globusID);
+	//copy the callbacks so that they can be run without holding the lock, 
+	//which leaves them free to unsubscribe
+	std::vector<ChangeCallback> callbacks;
+	{
+		std::lock_guard<std::mutex> lock(subscriberMut);
+		if(globusID.empty()){
+			for(const auto& user : subscribers){
+				for(const auto& subscriber : user.second)
+					callbacks.push_back(subscriber.second);
+			}
+		}
+		else{
+			auto it=subscribers.find(globusID);
+			if(it==subscribers.end())
+				return;
+			for(const auto& subscriber : it->second)
+				callbacks.push_back(subscriber.second);
+		}
+	}
+	for(const auto& callback : callbacks){
+		try{
+			callback();
+		}catch(std::exception& ex){
+			std::cerr << "Exception in cluster state subscriber: " << ex.what() << std::endl;
+		}
+	}
+}
+
+void ClusterState::inform(kubernetes::Kind kind, const std::string& labelSelector, std::atomic<bool>& synced,
+                          void (ClusterState::*replace)(const rapidjson::Value&),
+                          void (ClusterState::*update)(const std::string&, const rapidjson::Value&)){
+	const std::chrono::seconds minBackoff(1), maxBackoff(30);
+	std::chrono::seconds backoff=minBackoff;
+	std::string resourceVersion;
+	while(!stop.load()){
+		try{
+			if(resourceVersion.empty()){ //need a full listing
+				auto result=kube.list(kind,ns,labelSelector);
+				if(result.status!=200)
+					throw std::runtime_error("list failed: "+kubernetes::errorMessage(result));
+				rapidjson::Document listing;
+				listing.Parse(result.body);
+				if(listing.HasParseError() || !listing.IsObject() || !listing.HasMember("items") 
+				   || !listing["items"].IsArray())
+					throw std::runtime_error("Unable to parse JSON from list");
+				(this->*replace)(listing["items"]);
+				resourceVersion=getResourceVersion(listing);
+				synced.store(true);
+				backoff=minBackoff;
+			}
+			//resume watching from the last version seen
+			bool expired=false;
+			auto result=kube.watch(kind,ns,labelSelector,resourceVersion,
+			  [&](const std::string& type, const rapidjson::Value& object)->bool{
+				if(type=="ERROR"){
+					//410 Gone means that our version is too old to resume from
+					if(object.HasMember("code") && object["code"].IsInt() && object["code"].GetInt()==410)
+						expired=true;
+					else
+						std::cerr << "Watch error: " << (object.HasMember("message") && object["message"].IsString() ? 
+						                                 object["message"].GetString() : "unknown") << std::endl;
+					return false;
+				}
+				if(type!="BOOKMARK")
+					(this->*update)(type,object);
+				std::string version=getResourceVersion(object);
+				if(!version.empty())
+					resourceVersion=version;
+				return !stop.load();
+			},300,[this]{ return stop.load(); });
+			if(result.status==410)
+				expired=true;
+			else if(result.status!=200)
+				throw std::runtime_error("watch failed: "+kubernetes::errorMessage(result));
+			if(expired){
+				//keep serving the current data while relisting
+				resourceVersion.clear();
+			}
+		}catch(std::exception& ex){
+			std::cerr << "Lost track of cluster state: " << ex.what() << std::endl;
+			synced.store(false);
+			resourceVersion.clear();
+			//wait in short steps so that shutting down is not delayed
+			for(auto waited=std::chrono::seconds(0); waited<backoff && !stop.load(); waited+=std::chrono::seconds(1))
+				std::this_thread::sleep_for(std::chrono::seconds(1));
+			backoff=std::min(backoff*2,maxBackoff);
+		}
+	}
+}
+
+void ClusterState::replacePods(const rapidjson::Value& items){
+	std::map<std::string,std::map<std::string,PodState>> newPods;
+	for(const auto& pod : items.GetArray()){
+		std::string user=userFromAppLabel(getLabel(pod,"app"));
+		if(user.empty())
+			continue;
+		PodState state=parsePodState(pod);
+		newPods[user][state.name]=state;
+	}
+	{
+		std::lock_guard<std::mutex> lock(mut);
+		pods.swap(newPods);
+	}
+	notify("");
+}
+
+void ClusterState::updatePod(const std::string& type, const rapidjson::Value& pod){
+	std::string user=userFromAppLabel(getLabel(pod,"app"));
+	if(user.empty())
+		return;
+	PodState state=parsePodState(pod);
+	{
+		std::lock_guard<std::mutex> lock(mut);
+		if(type=="DELETED"){
+			auto it=pods.find(user);
+			if(it==pods.end())
+				return;
+			it->second.erase(state.name);
+			if(it->second.empty())
+				pods.erase(it);
+		}
+		else
+			pods[user][state.name]=state;
+	}
+	notify(user);
+}
+
+void ClusterState::replaceServices(const rapidjson::Value& items){
+	std::map<std::string,unsigned int> newPorts;
+	for(const auto& service : items.GetArray()){
+		std::string user=userFromAppLabel(getSelectedApp(service));
+		if(user.empty())
+			continue;
+		try{
+			newPorts[user]=parseNodePort(service);
+		}catch(std::runtime_error& err){
+			//not (yet) a usable sandbox service
+		}
+	}
+	{
+		std::lock_guard<std::mutex> lock(mut);
+		nodePorts.swap(newPorts);
+	}
+	notifyObservers("");
+}
+
+void ClusterState::updateService(const std::string& type, const rapidjson::Value& service){
+	std::string user=userFromAppLabel(getSelectedApp(service));
+	if(user.empty())
+		return;
+	{
+		std::lock_guard<std::mutex> lock(mut);
+		if(type=="DELETED")
+			nodePorts.erase(user);
+		else{
+			try{
+				nodePorts[user]=parseNodePort(service);
+			}catch(std::runtime_error& err){
+				nodePorts.erase(user);
+			}
+		}
+	}
+	notifyObservers(user);
+}
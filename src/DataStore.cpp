@@ -0,0 +1,428 @@
+#include "DataStore.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio> //for rename
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <boost/archive/archive_exception.hpp>
+#include <boost/archive/text_iarchive.hpp>
+#include <boost/archive/text_oarchive.hpp>
+#include <boost/crc.hpp>
+#include <boost/serialization/map.hpp>
+#include <boost/serialization/string.hpp>
+
+namespace{
+	///The kinds of journal entries
+	const unsigned int recordEntry=1;
+	const unsigned int removeEntry=2;
+
+	///Each journal entry is preceded by its length and the CRC32 of its
+	///contents, each as four little-endian bytes
+	const std::size_t entryHeaderSize=8;
+
+	void put32(std::string& out, std::uint32_t value){
+		for(unsigned int i=0; i<4; i++)
+			out+=(char)((value>>(8*i))&0xFF);
+	}
+
+	std::uint32_t get32(const char* in){
+		std::uint32_t value=0;
+		for(unsigned int i=0; i<4; i++)
+			value|=(std::uint32_t)(unsigned char)in[i]<<(8*i);
+		return value;
+	}
+
+	std::uint32_t checksum(const char* data, std::size_t size){
+		boost::crc_32_type crc;
+		crc.process_bytes(data,size);
+		return crc.checksum();
+	}
+
+	std::string errorString(int err){
+		return "Error "+std::to_string(err)+" ("+strerror(err)+")";
+	}
+
+	bool fileExists(const std::string& path){
+		struct stat info;
+		return stat(path.c_str(),&info)==0;
+	}
+
+	///Write all of a buffer to a file descriptor
+	///\return whether the write succeeded; if not errno describes the failure
+	bool writeAll(int fd, const char* data, std::size_t size){
+		while(size){
+			ssize_t written=write(fd,data,size);
+			if(written<0){
+				if(errno==EINTR)
+					continue;
+				return false;
+			}
+			data+=written;
+			size-=written;
+		}
+		return true;
+	}
+
+	///Flush the directory containing a file, so that a rename or creation of
+	///the file is durable
+	void syncDirectory(const std::string& path){
+		auto slash=path.rfind('/');
+		std::string dir=(slash==std::string::npos ? "." : (slash==0 ? "/" : path.substr(0,slash)));
+		int fd=open(dir.c_str(),O_RDONLY|O_CLOEXEC);
+		if(fd<0)
+			return;
+		fsync(fd);
+		close(fd);
+	}
+
+	///Replace the contents of a file such that either the old or the new
+	///contents will be present, even after a crash
+	///\throws std::runtime_error
+	void replaceFile(const std::string& path, const std::string& data){
+		const std::string tmpName=path+".tmp";
+		int fd=open(tmpName.c_str(),O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC,S_IRUSR|S_IWUSR);
+		if(fd<0)
+			throw std::runtime_error("Unable to open "+tmpName+": "+errorString(errno));
+		if(!writeAll(fd,data.c_str(),data.size()) || fsync(fd)!=0){
+			int err=errno;
+			close(fd);
+			throw std::runtime_error("Unable to write "+tmpName+": "+errorString(err));
+		}
+		close(fd);
+		if(rename(tmpName.c_str(),path.c_str())!=0)
+			throw std::runtime_error("Unable to replace "+path+": "+errorString(errno));
+		syncDirectory(path);
+	}
+
+	std::string encodeEntry(unsigned int type, const std::string& globusID, const UserData* data){
+		std::ostringstream ss;
+		{
+			boost::archive::text_oarchive ar(ss,boost::archive::no_header);
+			ar << type << globusID;
+			if(data)
+				ar << *data;
+		}
+		std::string payload=ss.str();
+		std::string entry;
+		entry.reserve(entryHeaderSize+payload.size());
+		put32(entry,payload.size());
+		put32(entry,checksum(payload.c_str(),payload.size()));
+		entry+=payload;
+		return entry;
+	}
+}
+
+DataStore::DataStore(const std::string& dataPath, unsigned int syncInterval,
+                     unsigned int compactionThreshold):
+persistentPath(dataPath),
+journalPath(dataPath+".journal"),
+oldJournalPath(dataPath+".journal.old"),
+journalFD(-1),
+journalSize(0),
+journalEntries(0),
+oldJournalPresent(false),
+savedDataFound(false),
+appendedSeq(0),
+syncedSeq(0),
+syncInterval(syncInterval),
+compactionThreshold(compactionThreshold?compactionThreshold:1),
+stopMaintenance(false),
+compactionRequested(false)
+{
+	loadData();
+	maintenanceThread=std::thread(&DataStore::maintain,this);
+}
+
+DataStore::~DataStore(){
+	{
+		std::lock_guard<std::mutex> lock(maintenanceMut);
+		stopMaintenance=true;
+	}
+	maintenanceCond.notify_all();
+	if(maintenanceThread.joinable())
+		maintenanceThread.join();
+	try{
+		syncJournal(std::numeric_limits<std::uint64_t>::max());
+	}catch(std::runtime_error& err){
+		std::cerr << err.what() << std::endl;
+	}
+	if(journalFD>=0)
+		close(journalFD);
+}
+
+boost::optional<UserData> DataStore::find(const std::string& globusID){
+	UserData data;
+	if(!podMap.find(globusID,data))
+		return {};
+	return data;
+}
+
+void DataStore::record(const std::string& globusID, const UserData& data){
+	const std::string entry=encodeEntry(recordEntry,globusID,&data);
+	std::uint64_t seq;
+	{
+		std::lock_guard<std::mutex> lock(mut);
+		seq=append(entry);
+		podMap.insert_or_assign(globusID,data);
+	}
+	changed(seq);
+}
+
+bool DataStore::update(const std::string& globusID, const std::function<bool(UserData&)>& change){
+	std::uint64_t seq;
+	{
+		std::lock_guard<std::mutex> lock(mut);
+		UserData data;
+		if(!podMap.find(globusID,data) || !change(data))
+			return false;
+		seq=append(encodeEntry(recordEntry,globusID,&data));
+		podMap.insert_or_assign(globusID,data);
+	}
+	changed(seq);
+	return true;
+}
+
+void DataStore::remove(const std::string& globusID){
+	const std::string entry=encodeEntry(removeEntry,globusID,nullptr);
+	std::uint64_t seq;
+	{
+		std::lock_guard<std::mutex> lock(mut);
+		if(!podMap.contains(globusID))
+			return;
+		seq=append(entry);
+		podMap.erase(globusID);
+	}
+	changed(seq);
+}
+
+std::map<std::string,UserData> DataStore::records(){
+	std::map<std::string,UserData> result;
+	auto table=podMap.lock_table();
+	for(const auto& account : table)
+		result.emplace(account.first,account.second);
+	return result;
+}
+
+void DataStore::loadData(){
+	std::map<std::string,UserData> records;
+	std::ifstream in(persistentPath);
+	if(!in){
+		std::cout << "Unable to read '" << persistentPath
+		  << "'; continuing with no saved user data" << std::endl;
+	}
+	else{
+		boost::archive::text_iarchive ar(in);
+		ar >> records;
+		savedDataFound=true;
+	}
+
+	//a leftover old journal means that a compaction did not finish, so its
+	//entries may not be in the snapshot
+	if(fileExists(oldJournalPath)){
+		oldJournalPresent=true;
+		savedDataFound=true;
+		std::size_t entries;
+		replay(oldJournalPath,records,entries);
+	}
+	if(fileExists(journalPath)){
+		savedDataFound=true;
+		std::size_t validSize=replay(journalPath,records,journalEntries);
+		//anything after the last complete entry is the remains of a write
+		//which was interrupted, and must be removed so that new entries follow
+		//directly after the valid ones
+		struct stat info;
+		if(stat(journalPath.c_str(),&info)==0 && (std::size_t)info.st_size>validSize){
+			std::cerr << "Discarding " << (info.st_size-validSize)
+			  << " bytes of incomplete journal entries from " << journalPath << std::endl;
+			if(truncate(journalPath.c_str(),validSize)!=0)
+				throw std::runtime_error("Unable to truncate "+journalPath+": "+errorString(errno));
+		}
+	}
+	std::cout << "Reloaded " << records.size() << " account records" << std::endl;
+	for(const auto& account : records)
+		podMap.insert(account.first,account.second);
+
+	openJournal();
+	if(oldJournalPresent || journalEntries>=compactionThreshold)
+		compactionRequested=true;
+}
+
+std::size_t DataStore::replay(const std::string& path, std::map<std::string,UserData>& records,
+                              std::size_t& entries){
+	entries=0;
+	std::ifstream in(path,std::ios::binary);
+	if(!in)
+		throw std::runtime_error("Unable to read "+path);
+	std::ostringstream ss;
+	ss << in.rdbuf();
+	const std::string data=ss.str();
+
+	std::size_t pos=0;
+	while(data.size()-pos>=entryHeaderSize){
+		const std::size_t size=get32(data.c_str()+pos);
+		const std::uint32_t crc=get32(data.c_str()+pos+4);
+		if(data.size()-pos-entryHeaderSize<size)
+			break; //truncated
+		const char* payload=data.c_str()+pos+entryHeaderSize;
+		if(checksum(payload,size)!=crc)
+			break; //corrupted
+		try{
+			std::istringstream entry(std::string(payload,size));
+			boost::archive::text_iarchive ar(entry,boost::archive::no_header);
+			unsigned int type;
+			std::string globusID;
+			ar >> type >> globusID;
+			if(type==recordEntry){
+				UserData account;
+				ar >> account;
+				records[globusID]=account;
+			}
+			else if(type==removeEntry)
+				records.erase(globusID);
+			else
+				break;
+		}catch(boost::archive::archive_exception& ex){
+			break;
+		}
+		pos+=entryHeaderSize+size;
+		entries++;
+	}
+	return pos;
+}
+
+void DataStore::openJournal(){
+	journalFD=open(journalPath.c_str(),O_WRONLY|O_CREAT|O_APPEND|O_CLOEXEC,S_IRUSR|S_IWUSR);
+	if(journalFD<0)
+		throw std::runtime_error("Unable to open "+journalPath+": "+errorString(errno));
+	struct stat info;
+	if(fstat(journalFD,&info)!=0)
+		throw std::runtime_error("Unable to stat "+journalPath+": "+errorString(errno));
+	journalSize=info.st_size;
+}
+
+std::uint64_t DataStore::append(const std::string& entry){
+	if(journalFD<0) //a previous rotation failed part way through
+		openJournal();
+	if(!writeAll(journalFD,entry.c_str(),entry.size())){
+		int err=errno;
+		//do not leave a partial entry for later entries to be appended after
+		if(ftruncate(journalFD,journalSize)!=0)
+			std::cerr << "Unable to remove partial journal entry: " << errorString(errno) << std::endl;
+		throw std::runtime_error("Unable to write to "+journalPath+": "+errorString(err));
+	}
+	journalSize+=entry.size();
+	if(++journalEntries>=compactionThreshold){
+		std::lock_guard<std::mutex> lock(maintenanceMut);
+		if(!compactionRequested){
+			compactionRequested=true;
+			maintenanceCond.notify_all();
+		}
+	}
+	return ++appendedSeq;
+}
+
+void DataStore::syncJournal(std::uint64_t seq){
+	std::lock_guard<std::mutex> syncLock(syncMut);
+	//whoever gets here first flushes everything appended so far, including
+	//the entries of any threads which arrive while the flush is in progress
+	int fd;
+	std::uint64_t target;
+	{
+		std::lock_guard<std::mutex> lock(mut);
+		fd=journalFD;
+		target=appendedSeq;
+	}
+	if(syncedSeq>=std::min(seq,target))
+		return;
+	if(fd>=0 && fsync(fd)!=0)
+		throw std::runtime_error("Unable to sync "+journalPath+": "+errorString(errno));
+	syncedSeq=target;
+}
+
+void DataStore::changed(std::uint64_t seq){
+	if(!syncInterval)
+		syncJournal(seq);
+}
+
+void DataStore::compact(){
+	std::map<std::string,UserData> snapshot;
+	{
+		std::lock_guard<std::mutex> syncLock(syncMut);
+		std::lock_guard<std::mutex> lock(mut);
+		//If an earlier compaction failed, its old journal is still needed, so
+		//the current journal cannot be rotated. Writing the snapshot and
+		//leaving the current journal in place is still correct, since
+		//replaying entries which are already in the snapshot has no effect.
+		if(!oldJournalPresent){
+			if(journalFD>=0){
+				if(fsync(journalFD)!=0)
+					throw std::runtime_error("Unable to sync "+journalPath+": "+errorString(errno));
+				close(journalFD);
+				journalFD=-1;
+			}
+			syncedSeq=appendedSeq;
+			if(rename(journalPath.c_str(),oldJournalPath.c_str())!=0)
+				throw std::runtime_error("Unable to rotate "+journalPath+": "+errorString(errno));
+			oldJournalPresent=true;
+			syncDirectory(journalPath);
+			journalEntries=0;
+			openJournal();
+		}
+		//holding mut keeps the records from changing while they are copied
+		snapshot=records();
+	}
+
+	std::ostringstream ss;
+	{
+		boost::archive::text_oarchive ar(ss);
+		ar << snapshot;
+	}
+	replaceFile(persistentPath,ss.str());
+
+	std::lock_guard<std::mutex> lock(mut);
+	if(unlink(oldJournalPath.c_str())!=0 && errno!=ENOENT)
+		throw std::runtime_error("Unable to remove "+oldJournalPath+": "+errorString(errno));
+	oldJournalPresent=false;
+}
+
+void DataStore::maintain(){
+	std::unique_lock<std::mutex> lock(maintenanceMut);
+	while(!stopMaintenance){
+		if(!compactionRequested){
+			if(syncInterval)
+				maintenanceCond.wait_for(lock,std::chrono::milliseconds(syncInterval));
+			else
+				maintenanceCond.wait(lock);
+		}
+		if(stopMaintenance)
+			break;
+		bool compactNow=compactionRequested;
+		compactionRequested=false;
+		lock.unlock();
+		try{
+			if(syncInterval)
+				syncJournal(std::numeric_limits<std::uint64_t>::max());
+			if(compactNow)
+				compact();
+		}catch(std::runtime_error& err){
+			std::cerr << "Data store maintenance failed: " << err.what() << std::endl;
+			//try again later, but avoid retrying continuously
+			std::this_thread::sleep_for(std::chrono::seconds(1));
+			lock.lock();
+			compactionRequested|=compactNow;
+			continue;
+		}
+		lock.lock();
+	}
+}
@@ -0,0 +1,32 @@
+#include "EndpointCache.h"
+
+EndpointCache::EndpointCache(std::chrono::seconds ttl):ttl(ttl){}
+
+boost::optional<Endpoint> EndpointCache::find(const std::string& globusID){
+	std::lock_guard<std::mutex> lock(mut);
+	auto it=entries.find(globusID);
+	if(it==entries.end())
+		return {};
+	if(clock::now()>=it->second.expires){
+		entries.erase(it);
+		return {};
+	}
+	return it->second.endpoint;
+}
+
+void EndpointCache::store(const std::string& globusID, const Endpoint& endpoint){
+	if(ttl.count()==0)
+		return;
+	std::lock_guard<std::mutex> lock(mut);
+	entries[globusID]=Entry{endpoint,clock::now()+ttl};
+}
+
+void EndpointCache::invalidate(const std::string& globusID){
+	std::lock_guard<std::mutex> lock(mut);
+	entries.erase(globusID);
+}
+
+void EndpointCache::clear(){
+	std::lock_guard<std::mutex> lock(mut);
+	entries.clear();
+}
@@ -1,9 +1,19 @@
 #include <cassert>
+#include <cerrno>
+#include <condition_variable>
+#include <deque>
 #include <iostream>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
 
 #include <curl/curl.h>
 
@@ -88,43 +98,286 @@ auto sendCurlInput(char* buffer, size_t size, size_t nitems, void* userp)->size_
 		throw std::runtime_error(expl+"\n curl error: "+curl_easy_strerror(err));
 }
 
+///Extract the part of a URL which identifies the server: the scheme, host, 
+///and port
+std::string hostKey(const std::string& url){
+	std::size_t start=url.find("://");
+	start=(start==std::string::npos?0:start+3);
+	std::size_t end=url.find_first_of("/?#",start);
+	return url.substr(0,end);
+}
+
 } //namespace detail
 
-Response httpGet(const std::string& url, const Options& options){
+///The curl handles and shared cache belonging to a Client
+struct Client::Pool{
+	const ClientOptions options;
+	///The cache of DNS results and TLS sessions shared by all handles. Open 
+	///connections are not shared, since libcurl does not support sharing 
+	///them between handles in use on different threads at once; instead each 
+	///handle keeps its own connections, and is lent out again for the same 
+	///host when possible. 
+	CURLSH* share;
+	///The locks libcurl asks for to protect each kind of shared data
+	std::mutex shareLocks[CURL_LOCK_DATA_LAST];
+	
+	std::mutex mut;
+	///Signalled when a request to a host finishes
+	std::condition_variable hostFree;
+	///Handles which are not in use, indexed by the host to which they last 
+	///made a request, and so may still have a connection open
+	std::map<std::string,std::vector<CURL*>> idle;
+	///The total number of idle handles
+	std::size_t idleCount=0;
+	///The number of requests in progress to each host, for those hosts which 
+	///have any
+	std::map<std::string,unsigned int> active;
+	
+	explicit Pool(const ClientOptions& options);
+	~Pool();
+	
+	///A handle borrowed from the pool, which is returned when this object is 
+	///destroyed
+	class Session{
+	public:
+		Session(Pool& pool, CURL* handle, std::string host, bool limited):
+		pool(pool),handle(handle),host(std::move(host)),limited(limited){}
+		~Session(){ pool.release(handle,host,limited); }
+		Session(const Session&)=delete;
+		Session& operator=(const Session&)=delete;
+		CURL* get() const{ return handle; }
+	private:
+		Pool& pool;
+		CURL* handle;
+		///The host to which the request is made
+		std::string host;
+		///Whether the request was counted against the host's limit
+		bool limited;
+	};
+	
+	///Borrow a handle, reset to its default state and attached to the shared 
+	///cache
+	///\param url the URL which will be requested
+	///\param limited whether the request counts against the limit on 
+	///               concurrent requests to the host, in which case this waits 
+	///               until the request is allowed
+	std::unique_ptr<Session> acquire(const std::string& url, bool limited);
+	void release(CURL* handle, const std::string& host, bool limited);
+	
+	static void lockShare(CURL*, curl_lock_data data, curl_lock_access, void* userp){
+		static_cast<Pool*>(userp)->shareLocks[data].lock();
+	}
+	static void unlockShare(CURL*, curl_lock_data data, void* userp){
+		static_cast<Pool*>(userp)->shareLocks[data].unlock();
+	}
+};
+
+Client::Pool::Pool(const ClientOptions& options):options(options),share(curl_share_init()){
+	if(!share)
+		throw std::runtime_error("Failed to initialize curl share");
+	curl_share_setopt(share, CURLSHOPT_LOCKFUNC, &Pool::lockShare);
+	curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, &Pool::unlockShare);
+	curl_share_setopt(share, CURLSHOPT_USERDATA, this);
+	curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+	curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+}
+
+Client::Pool::~Pool(){
+	//all handles must be detached from the share before it can be cleaned up
+	for(auto& host : idle){
+		for(CURL* handle : host.second)
+			curl_easy_cleanup(handle);
+	}
+	curl_share_cleanup(share);
+}
+
+std::unique_ptr<Client::Pool::Session> Client::Pool::acquire(const std::string& url, bool limited){
+	CURL* handle=nullptr;
+	const std::string host=detail::hostKey(url);
+	limited=limited && options.maxRequestsPerHost;
+	{
+		std::unique_lock<std::mutex> lock(mut);
+		if(limited){
+			hostFree.wait(lock,[&]{ return active[host]<options.maxRequestsPerHost; });
+			active[host]++;
+		}
+		//prefer a handle which may already be connected to the host, but 
+		//otherwise any idle handle will do
+		auto it=idle.find(host);
+		if(it==idle.end())
+			it=idle.begin();
+		if(it!=idle.end()){
+			handle=it->second.back();
+			it->second.pop_back();
+			if(it->second.empty())
+				idle.erase(it);
+			idleCount--;
+		}
+	}
+	if(!handle)
+		handle=curl_easy_init();
+	if(!handle){
+		release(nullptr,host,limited);
+		throw std::runtime_error("Failed to initialize curl session");
+	}
+	std::unique_ptr<Session> session(new Session(*this,handle,host,limited));
+	//resetting the options leaves the handle's connections open
+	curl_easy_reset(handle);
+	curl_easy_setopt(handle, CURLOPT_SHARE, share);
+	if(options.keepAliveIdle){
+		curl_easy_setopt(handle, CURLOPT_TCP_KEEPALIVE, 1L);
+		curl_easy_setopt(handle, CURLOPT_TCP_KEEPIDLE, options.keepAliveIdle);
+	}
+	return session;
+}
+
+void Client::Pool::release(CURL* handle, const std::string& host, bool limited){
+	bool keep=false;
+	{
+		std::lock_guard<std::mutex> lock(mut);
+		if(limited && !--active[host])
+			active.erase(host);
+		if(handle && idleCount<options.maxIdleHandles){
+			idle[host].push_back(handle);
+			idleCount++;
+			keep=true;
+		}
+	}
+	if(limited)
+		hostFree.notify_all();
+	if(handle && !keep)
+		curl_easy_cleanup(handle);
+}
+
+namespace detail{
+
+///Construct the list of extra headers to send with a request
+///\param options the request options, which may include a bearer token
+///\param withContentType whether to include the content type header
+std::unique_ptr<curl_slist,void (*)(curl_slist*)> makeHeaders(const Options& options, bool withContentType){
+	std::unique_ptr<curl_slist,void (*)(curl_slist*)> headerList(nullptr,curl_slist_free_all);
+	if(withContentType)
+		headerList.reset(curl_slist_append(headerList.release(),("Content-Type: "+options.contentType).c_str()));
+	if(!options.bearerToken.empty())
+		headerList.reset(curl_slist_append(headerList.release(),("Authorization: Bearer "+options.bearerToken).c_str()));
+	return headerList;
+}
+
+///Apply the TLS verification, client authentication, and timeout settings 
+///from a set of options to a curl session
+void setConnectionOptions(CURL* curlSession, const Options& options, const char* errBuf){
+	CURLcode err;
+	if(options.timeout){
+		err=curl_easy_setopt(curlSession, CURLOPT_TIMEOUT, options.timeout);
+		if(err!=CURLE_OK)
+			reportCurlError("Failed to set curl timeout",err,errBuf);
+	}
+	if(!options.caBundlePath.empty()){
+		err=curl_easy_setopt(curlSession, CURLOPT_CAINFO, options.caBundlePath.c_str());
+		if(err!=CURLE_OK)
+			reportCurlError("Failed to set curl CA bundle path",err,errBuf);
+	}
+	if(!options.clientCertPath.empty()){
+		err=curl_easy_setopt(curlSession, CURLOPT_SSLCERT, options.clientCertPath.c_str());
+		if(err!=CURLE_OK)
+			reportCurlError("Failed to set curl client certificate path",err,errBuf);
+	}
+	if(!options.clientKeyPath.empty()){
+		err=curl_easy_setopt(curlSession, CURLOPT_SSLKEY, options.clientKeyPath.c_str());
+		if(err!=CURLE_OK)
+			reportCurlError("Failed to set curl client key path",err,errBuf);
+	}
+}
+
+///Helper data used for passing streamed output data from libcurl to a callback
+struct CurlStreamData{
+	///The session, used to check the response status
+	CURL* session;
+	///The consumer of successfully returned data
+	const std::function<bool(const char*,std::size_t)>& consumer;
+	///Where data accompanying an error response is collected
+	CurlOutputData errorOutput;
+};
+
+///Callback function for passing data from libcurl to a consumer, and only to 
+///be called by libcurl. See https://curl.haxx.se/libcurl/c/CURLOPT_WRITEFUNCTION.html
+///\param userp pointer to a CurlStreamData object
+size_t streamCurlOutput(void* buffer, size_t size, size_t nmemb, void* userp){
+	CurlStreamData& data=*static_cast<CurlStreamData*>(userp);
+	long code=0;
+	curl_easy_getinfo(data.session,CURLINFO_RESPONSE_CODE,&code);
+	if(code>=300)
+		return collectCurlOutput(buffer,size,nmemb,&data.errorOutput);
+	//curl can't tolerate exceptions, so stop them and log them to stderr here
+	try{
+		if(!data.consumer((const char*)buffer,size*nmemb))
+			return((size*nmemb)==0); //return a different number to stop the transfer
+	}catch(std::exception& ex){
+		std::cerr << data.errorOutput.context << " Exception thrown while consuming output: " 
+		  << ex.what() << std::endl;
+		return((size*nmemb)==0);
+	}catch(...){
+		std::cerr << data.errorOutput.context << " Exception thrown while consuming output" << std::endl;
+		return((size*nmemb)==0);
+	}
+	return(size*nmemb);
+}
+
+///Progress callback for streaming transfers, which libcurl calls about once a 
+///second even when no data is arriving. It gives the consumer a chance to stop 
+///an idle stream by passing it no data. 
+///See https://curl.haxx.se/libcurl/c/CURLOPT_XFERINFOFUNCTION.html
+///\tparam Amount the type in which libcurl reports transfer sizes, which 
+///               depends on whether the newer XFERINFO callback is available
+///\param userp pointer to a CurlStreamData object
+template<typename Amount>
+int pollCurlStream(void* userp, Amount, Amount, Amount, Amount){
+	CurlStreamData& data=*static_cast<CurlStreamData*>(userp);
+	try{
+		return data.consumer(nullptr,0)?0:1;
+	}catch(...){
+		return 1;
+	}
+}
+
+} //namespace detail
+
+Response Client::get(const std::string& url, const Options& options) const{
 	detail::CurlOutputData data{{},"GET "+url};
 	
 	CURLcode err;
 	std::unique_ptr<char[]> errBuf(new char[CURL_ERROR_SIZE]);
 	errBuf[0]=0;
-	std::unique_ptr<CURL,void (*)(CURL*)> curlSession(curl_easy_init(),curl_easy_cleanup);
+	auto session=pool->acquire(url,true);
+	CURL* curlSession=session->get();
 	using detail::reportCurlError;
 	
-	err=curl_easy_setopt(curlSession.get(), CURLOPT_ERRORBUFFER, errBuf.get());
+	err=curl_easy_setopt(curlSession, CURLOPT_ERRORBUFFER, errBuf.get());
 	if(err!=CURLE_OK)
 		throw std::runtime_error("Failed to set curl error buffer");
-	err=curl_easy_setopt(curlSession.get(), CURLOPT_URL, url.c_str());
+	err=curl_easy_setopt(curlSession, CURLOPT_URL, url.c_str());
 	if(err!=CURLE_OK)
 		detail::reportCurlError("Failed to set curl URL option",err,errBuf.get());
-	err=curl_easy_setopt(curlSession.get(), CURLOPT_HTTPGET, 1);
+	err=curl_easy_setopt(curlSession, CURLOPT_HTTPGET, 1);
 	if(err!=CURLE_OK)
 		detail::reportCurlError("Failed to set curl GET option",err,errBuf.get());
-	err=curl_easy_setopt(curlSession.get(), CURLOPT_WRITEFUNCTION, detail::collectCurlOutput);
+	err=curl_easy_setopt(curlSession, CURLOPT_WRITEFUNCTION, detail::collectCurlOutput);
 	if(err!=CURLE_OK)
 		detail::reportCurlError("Failed to set curl output callback",err,errBuf.get());
-	err=curl_easy_setopt(curlSession.get(), CURLOPT_WRITEDATA, &data);
+	err=curl_easy_setopt(curlSession, CURLOPT_WRITEDATA, &data);
 	if(err!=CURLE_OK)
 		detail::reportCurlError("Failed to set curl output callback data",err,errBuf.get());
-	if(!options.caBundlePath.empty()){
-		err=curl_easy_setopt(curlSession.get(), CURLOPT_CAINFO, options.caBundlePath.c_str());
-		if(err!=CURLE_OK)
-			reportCurlError("Failed to set curl CA bundle path",err,errBuf.get());
-	}
-	err=curl_easy_perform(curlSession.get());
+	auto headerList=detail::makeHeaders(options,false);
+	err=curl_easy_setopt(curlSession, CURLOPT_HTTPHEADER, headerList.get());
+	if(err!=CURLE_OK)
+		reportCurlError("Failed to set request headers",err,errBuf.get());
+	detail::setConnectionOptions(curlSession,options,errBuf.get());
+	err=curl_easy_perform(curlSession);
 	if(err!=CURLE_OK)
 		detail::reportCurlError("curl perform GET failed",err,errBuf.get());
 		
 	long code;
-	err=curl_easy_getinfo(curlSession.get(),CURLINFO_RESPONSE_CODE,&code);
+	err=curl_easy_getinfo(curlSession,CURLINFO_RESPONSE_CODE,&code);
 	if(err!=CURLE_OK)
 		detail::reportCurlError("Failed to get HTTP response code from curl",err,errBuf.get());
 	assert(code>=0);
@@ -132,41 +385,56 @@ Response httpGet(const std::string& url, const Options& options){
 	return Response{(unsigned int)code,data.output};
 }
 
-Response httpDelete(const std::string& url, const Options& options){
+Response Client::del(const std::string& url, const Options& options) const{
+	return del(url,"",options);
+}
+
+Response Client::del(const std::string& url, const std::string& body, 
+                     const Options& options) const{
+	curl_off_t dataSize=body.size();
 	detail::CurlOutputData data{{},"DELETE "+url};
 	
 	CURLcode err;
 	std::unique_ptr<char[]> errBuf(new char[CURL_ERROR_SIZE]);
 	errBuf[0]=0;
-	std::unique_ptr<CURL,void (*)(CURL*)> curlSession(curl_easy_init(),curl_easy_cleanup);
+	auto session=pool->acquire(url,true);
+	CURL* curlSession=session->get();
 	using detail::reportCurlError;
 	
-	err=curl_easy_setopt(curlSession.get(), CURLOPT_ERRORBUFFER, errBuf.get());
+	err=curl_easy_setopt(curlSession, CURLOPT_ERRORBUFFER, errBuf.get());
 	if(err!=CURLE_OK)
 		throw std::runtime_error("Failed to set curl error buffer");
-	err=curl_easy_setopt(curlSession.get(), CURLOPT_URL, url.c_str());
+	err=curl_easy_setopt(curlSession, CURLOPT_URL, url.c_str());
 	if(err!=CURLE_OK)
 		reportCurlError("Failed to set curl URL option",err,errBuf.get());
-	err=curl_easy_setopt(curlSession.get(), CURLOPT_CUSTOMREQUEST, "DELETE");
+	err=curl_easy_setopt(curlSession, CURLOPT_CUSTOMREQUEST, "DELETE");
 	if(err!=CURLE_OK)
 		reportCurlError("Failed to set curl DELETE option",err,errBuf.get());
-	err=curl_easy_setopt(curlSession.get(), CURLOPT_WRITEFUNCTION, detail::collectCurlOutput);
+	if(!body.empty()){
+		err=curl_easy_setopt(curlSession, CURLOPT_POSTFIELDS, body.c_str());
+		if(err!=CURLE_OK)
+			reportCurlError("Failed to set curl DELETE data",err,errBuf.get());
+		err=curl_easy_setopt(curlSession, CURLOPT_POSTFIELDSIZE_LARGE, dataSize);
+		if(err!=CURLE_OK)
+			reportCurlError("Failed to set curl DELETE data size",err,errBuf.get());
+	}
+	err=curl_easy_setopt(curlSession, CURLOPT_WRITEFUNCTION, detail::collectCurlOutput);
 	if(err!=CURLE_OK)
 		reportCurlError("Failed to set curl output callback",err,errBuf.get());
-	err=curl_easy_setopt(curlSession.get(), CURLOPT_WRITEDATA, &data);
+	err=curl_easy_setopt(curlSession, CURLOPT_WRITEDATA, &data);
 	if(err!=CURLE_OK)
 		reportCurlError("Failed to set curl output callback data",err,errBuf.get());
-	if(!options.caBundlePath.empty()){
-		err=curl_easy_setopt(curlSession.get(), CURLOPT_CAINFO, options.caBundlePath.c_str());
-		if(err!=CURLE_OK)
-			reportCurlError("Failed to set curl CA bundle path",err,errBuf.get());
-	}
-	err=curl_easy_perform(curlSession.get());
+	auto headerList=detail::makeHeaders(options,!body.empty());
+	err=curl_easy_setopt(curlSession, CURLOPT_HTTPHEADER, headerList.get());
+	if(err!=CURLE_OK)
+		reportCurlError("Failed to set request headers",err,errBuf.get());
+	detail::setConnectionOptions(curlSession,options,errBuf.get());
+	err=curl_easy_perform(curlSession);
 	if(err!=CURLE_OK)
 		reportCurlError("curl perform GET failed",err,errBuf.get());
 		
 	long code;
-	err=curl_easy_getinfo(curlSession.get(),CURLINFO_RESPONSE_CODE,&code);
+	err=curl_easy_getinfo(curlSession,CURLINFO_RESPONSE_CODE,&code);
 	if(err!=CURLE_OK)
 		reportCurlError("Failed to get HTTP response code from curl",err,errBuf.get());
 	assert(code>=0);
@@ -174,8 +442,8 @@ Response httpDelete(const std::string& url, const Options& options){
 	return Response{(unsigned int)code,data.output};
 }
 
-Response httpPut(const std::string& url, const std::string& body, 
-                 const Options& options){
+Response Client::put(const std::string& url, const std::string& body, 
+                    const Options& options) const{
 	curl_off_t dataSize=body.size();
 	detail::CurlInputData input(body,"PUT "+url);
 	detail::CurlOutputData output{{},"PUT "+url};
@@ -183,50 +451,46 @@ Response httpPut(const std::string& url, const std::string& body,
 	CURLcode err;
 	std::unique_ptr<char[]> errBuf(new char[CURL_ERROR_SIZE]);
 	errBuf[0]=0;
-	std::unique_ptr<CURL,void (*)(CURL*)> curlSession(curl_easy_init(),curl_easy_cleanup);
+	auto session=pool->acquire(url,true);
+	CURL* curlSession=session->get();
 	using detail::reportCurlError;
 	
-	err=curl_easy_setopt(curlSession.get(), CURLOPT_ERRORBUFFER, errBuf.get());
+	err=curl_easy_setopt(curlSession, CURLOPT_ERRORBUFFER, errBuf.get());
 	if(err!=CURLE_OK)
 		throw std::runtime_error("Failed to set curl error buffer");
-	err=curl_easy_setopt(curlSession.get(), CURLOPT_URL, url.c_str());
+	err=curl_easy_setopt(curlSession, CURLOPT_URL, url.c_str());
 	if(err!=CURLE_OK)
 		reportCurlError("Failed to set curl URL option",err,errBuf.get());
-	err=curl_easy_setopt(curlSession.get(), CURLOPT_UPLOAD, 1);
+	err=curl_easy_setopt(curlSession, CURLOPT_UPLOAD, 1);
 	if(err!=CURLE_OK)
 		reportCurlError("Failed to set curl PUT/upload option",err,errBuf.get());
-	err=curl_easy_setopt(curlSession.get(), CURLOPT_READFUNCTION, detail::sendCurlInput);
+	err=curl_easy_setopt(curlSession, CURLOPT_READFUNCTION, detail::sendCurlInput);
 	if(err!=CURLE_OK)
 		reportCurlError("Failed to set curl input callback",err,errBuf.get());
-	err=curl_easy_setopt(curlSession.get(), CURLOPT_READDATA, &input);
+	err=curl_easy_setopt(curlSession, CURLOPT_READDATA, &input);
 	if(err!=CURLE_OK)
 		reportCurlError("Failed to set curl input callback data",err,errBuf.get());
-	err=curl_easy_setopt(curlSession.get(), CURLOPT_INFILESIZE_LARGE, dataSize);
+	err=curl_easy_setopt(curlSession, CURLOPT_INFILESIZE_LARGE, dataSize);
 	if(err!=CURLE_OK)
 		reportCurlError("Failed to set curl input data size",err,errBuf.get());
-	err=curl_easy_setopt(curlSession.get(), CURLOPT_WRITEFUNCTION, detail::collectCurlOutput);
+	err=curl_easy_setopt(curlSession, CURLOPT_WRITEFUNCTION, detail::collectCurlOutput);
 	if(err!=CURLE_OK)
 		reportCurlError("Failed to set curl output callback",err,errBuf.get());
-	err=curl_easy_setopt(curlSession.get(), CURLOPT_WRITEDATA, &output);
+	err=curl_easy_setopt(curlSession, CURLOPT_WRITEDATA, &output);
 	if(err!=CURLE_OK)
 		reportCurlError("Failed to set curl output callback data",err,errBuf.get());
-	std::unique_ptr<curl_slist,void (*)(curl_slist*)> headerList(nullptr,curl_slist_free_all);
-	headerList.reset(curl_slist_append(headerList.release(),("Content-Type: "+options.contentType).c_str()));
-	err=curl_easy_setopt(curlSession.get(), CURLOPT_HTTPHEADER, headerList.get());
+	auto headerList=detail::makeHeaders(options,true);
+	err=curl_easy_setopt(curlSession, CURLOPT_HTTPHEADER, headerList.get());
 	if(err!=CURLE_OK)
 		reportCurlError("Failed to set request headers",err,errBuf.get());
-	if(!options.caBundlePath.empty()){
-		err=curl_easy_setopt(curlSession.get(), CURLOPT_CAINFO, options.caBundlePath.c_str());
-		if(err!=CURLE_OK)
-			reportCurlError("Failed to set curl CA bundle path",err,errBuf.get());
-	}
+	detail::setConnectionOptions(curlSession,options,errBuf.get());
 		
-	err=curl_easy_perform(curlSession.get());
+	err=curl_easy_perform(curlSession);
 	if(err!=CURLE_OK)
 		reportCurlError("curl perform PUT failed",err,errBuf.get());
 		
 	long code;
-	err=curl_easy_getinfo(curlSession.get(),CURLINFO_RESPONSE_CODE,&code);
+	err=curl_easy_getinfo(curlSession,CURLINFO_RESPONSE_CODE,&code);
 	if(err!=CURLE_OK)
 		reportCurlError("Failed to get HTTP response code from curl",err,errBuf.get());
 	assert(code>=0);
@@ -234,52 +498,48 @@ Response httpPut(const std::string& url, const std::string& body,
 	return Response{(unsigned int)code,output.output};
 }
 
-Response httpPost(const std::string& url, const std::string& body, 
-                  const Options& options){
+Response Client::post(const std::string& url, const std::string& body, 
+                     const Options& options) const{
 	curl_off_t dataSize=body.size();
 	detail::CurlOutputData output{{},"POST "+url};
 	
 	CURLcode err;
 	std::unique_ptr<char[]> errBuf(new char[CURL_ERROR_SIZE]);
 	errBuf[0]=0;
-	std::unique_ptr<CURL,void (*)(CURL*)> curlSession(curl_easy_init(),curl_easy_cleanup);
+	auto session=pool->acquire(url,true);
+	CURL* curlSession=session->get();
 	using detail::reportCurlError;
 	
-	err=curl_easy_setopt(curlSession.get(), CURLOPT_ERRORBUFFER, errBuf.get());
+	err=curl_easy_setopt(curlSession, CURLOPT_ERRORBUFFER, errBuf.get());
 	if(err!=CURLE_OK)
 		throw std::runtime_error("Failed to set curl error buffer");
-	err=curl_easy_setopt(curlSession.get(), CURLOPT_URL, url.c_str());
+	err=curl_easy_setopt(curlSession, CURLOPT_URL, url.c_str());
 	if(err!=CURLE_OK)
 		reportCurlError("Failed to set curl URL option",err,errBuf.get());
-	err=curl_easy_setopt(curlSession.get(), CURLOPT_POSTFIELDS, body.c_str());
+	err=curl_easy_setopt(curlSession, CURLOPT_POSTFIELDS, body.c_str());
 	if(err!=CURLE_OK)
 		reportCurlError("Failed to set curl POST data",err,errBuf.get());
-	err=curl_easy_setopt(curlSession.get(), CURLOPT_POSTFIELDSIZE_LARGE, dataSize);
+	err=curl_easy_setopt(curlSession, CURLOPT_POSTFIELDSIZE_LARGE, dataSize);
 	if(err!=CURLE_OK)
 		reportCurlError("Failed to set curl POST data size",err,errBuf.get());
-	err=curl_easy_setopt(curlSession.get(), CURLOPT_WRITEFUNCTION, detail::collectCurlOutput);
+	err=curl_easy_setopt(curlSession, CURLOPT_WRITEFUNCTION, detail::collectCurlOutput);
 	if(err!=CURLE_OK)
 		reportCurlError("Failed to set curl output callback",err,errBuf.get());
-	err=curl_easy_setopt(curlSession.get(), CURLOPT_WRITEDATA, &output);
+	err=curl_easy_setopt(curlSession, CURLOPT_WRITEDATA, &output);
 	if(err!=CURLE_OK)
 		reportCurlError("Failed to set curl output callback data",err,errBuf.get());	
-	std::unique_ptr<curl_slist,void (*)(curl_slist*)> headerList(nullptr,curl_slist_free_all);
-	headerList.reset(curl_slist_append(headerList.release(),("Content-Type: "+options.contentType).c_str()));
-	err=curl_easy_setopt(curlSession.get(), CURLOPT_HTTPHEADER, headerList.get());
+	auto headerList=detail::makeHeaders(options,true);
+	err=curl_easy_setopt(curlSession, CURLOPT_HTTPHEADER, headerList.get());
 	if(err!=CURLE_OK)
 		reportCurlError("Failed to set request headers",err,errBuf.get());
-	if(!options.caBundlePath.empty()){
-		err=curl_easy_setopt(curlSession.get(), CURLOPT_CAINFO, options.caBundlePath.c_str());
-		if(err!=CURLE_OK)
-			reportCurlError("Failed to set curl CA bundle path",err,errBuf.get());
-	}
+	detail::setConnectionOptions(curlSession,options,errBuf.get());
 		
-	err=curl_easy_perform(curlSession.get());
+	err=curl_easy_perform(curlSession);
 	if(err!=CURLE_OK)
 		reportCurlError("curl perform POST failed",err,errBuf.get());
 		
 	long code;
-	err=curl_easy_getinfo(curlSession.get(),CURLINFO_RESPONSE_CODE,&code);
+	err=curl_easy_getinfo(curlSession,CURLINFO_RESPONSE_CODE,&code);
 	if(err!=CURLE_OK)
 		reportCurlError("Failed to get HTTP response code from curl",err,errBuf.get());
 	assert(code>=0);
@@ -287,4 +547,418 @@ Response httpPost(const std::string& url, const std::string& body,
 	return Response{(unsigned int)code,output.output};
 }
 
+Response Client::patch(const std::string& url, const std::string& body, 
+                      const Options& options) const{
+	curl_off_t dataSize=body.size();
+	detail::CurlOutputData output{{},"PATCH "+url};
+	
+	CURLcode err;
+	std::unique_ptr<char[]> errBuf(new char[CURL_ERROR_SIZE]);
+	errBuf[0]=0;
+	auto session=pool->acquire(url,true);
+	CURL* curlSession=session->get();
+	using detail::reportCurlError;
+	
+	err=curl_easy_setopt(curlSession, CURLOPT_ERRORBUFFER, errBuf.get());
+	if(err!=CURLE_OK)
+		throw std::runtime_error("Failed to set curl error buffer");
+	err=curl_easy_setopt(curlSession, CURLOPT_URL, url.c_str());
+	if(err!=CURLE_OK)
+		reportCurlError("Failed to set curl URL option",err,errBuf.get());
+	err=curl_easy_setopt(curlSession, CURLOPT_CUSTOMREQUEST, "PATCH");
+	if(err!=CURLE_OK)
+		reportCurlError("Failed to set curl PATCH option",err,errBuf.get());
+	err=curl_easy_setopt(curlSession, CURLOPT_POSTFIELDS, body.c_str());
+	if(err!=CURLE_OK)
+		reportCurlError("Failed to set curl PATCH data",err,errBuf.get());
+	err=curl_easy_setopt(curlSession, CURLOPT_POSTFIELDSIZE_LARGE, dataSize);
+	if(err!=CURLE_OK)
+		reportCurlError("Failed to set curl PATCH data size",err,errBuf.get());
+	err=curl_easy_setopt(curlSession, CURLOPT_WRITEFUNCTION, detail::collectCurlOutput);
+	if(err!=CURLE_OK)
+		reportCurlError("Failed to set curl output callback",err,errBuf.get());
+	err=curl_easy_setopt(curlSession, CURLOPT_WRITEDATA, &output);
+	if(err!=CURLE_OK)
+		reportCurlError("Failed to set curl output callback data",err,errBuf.get());	
+	auto headerList=detail::makeHeaders(options,true);
+	err=curl_easy_setopt(curlSession, CURLOPT_HTTPHEADER, headerList.get());
+	if(err!=CURLE_OK)
+		reportCurlError("Failed to set request headers",err,errBuf.get());
+	detail::setConnectionOptions(curlSession,options,errBuf.get());
+		
+	err=curl_easy_perform(curlSession);
+	if(err!=CURLE_OK)
+		reportCurlError("curl perform PATCH failed",err,errBuf.get());
+		
+	long code;
+	err=curl_easy_getinfo(curlSession,CURLINFO_RESPONSE_CODE,&code);
+	if(err!=CURLE_OK)
+		reportCurlError("Failed to get HTTP response code from curl",err,errBuf.get());
+	assert(code>=0);
+		
+	return Response{(unsigned int)code,output.output};
+}
+
+Response Client::getStreaming(const std::string& url, 
+                                const std::function<bool(const char*,std::size_t)>& consumer, 
+                                const Options& options) const{
+	//streams are long-lived, so they are not counted against the host limit
+	auto session=pool->acquire(url,false);
+	CURL* curlSession=session->get();
+	detail::CurlStreamData data{curlSession,consumer,{{},"GET "+url}};
+	
+	CURLcode err;
+	std::unique_ptr<char[]> errBuf(new char[CURL_ERROR_SIZE]);
+	errBuf[0]=0;
+	using detail::reportCurlError;
+	
+	err=curl_easy_setopt(curlSession, CURLOPT_ERRORBUFFER, errBuf.get());
+	if(err!=CURLE_OK)
+		throw std::runtime_error("Failed to set curl error buffer");
+	err=curl_easy_setopt(curlSession, CURLOPT_URL, url.c_str());
+	if(err!=CURLE_OK)
+		reportCurlError("Failed to set curl URL option",err,errBuf.get());
+	err=curl_easy_setopt(curlSession, CURLOPT_HTTPGET, 1);
+	if(err!=CURLE_OK)
+		reportCurlError("Failed to set curl GET option",err,errBuf.get());
+	err=curl_easy_setopt(curlSession, CURLOPT_WRITEFUNCTION, detail::streamCurlOutput);
+	if(err!=CURLE_OK)
+		reportCurlError("Failed to set curl output callback",err,errBuf.get());
+	err=curl_easy_setopt(curlSession, CURLOPT_WRITEDATA, &data);
+	if(err!=CURLE_OK)
+		reportCurlError("Failed to set curl output callback data",err,errBuf.get());
+#if LIBCURL_VERSION_NUM >= 0x072000 //7.32.0
+	err=curl_easy_setopt(curlSession, CURLOPT_XFERINFOFUNCTION, &detail::pollCurlStream<curl_off_t>);
+	if(err!=CURLE_OK)
+		reportCurlError("Failed to set curl progress callback",err,errBuf.get());
+	err=curl_easy_setopt(curlSession, CURLOPT_XFERINFODATA, &data);
+#else
+	err=curl_easy_setopt(curlSession, CURLOPT_PROGRESSFUNCTION, &detail::pollCurlStream<double>);
+	if(err!=CURLE_OK)
+		reportCurlError("Failed to set curl progress callback",err,errBuf.get());
+	err=curl_easy_setopt(curlSession, CURLOPT_PROGRESSDATA, &data);
+#endif
+	if(err!=CURLE_OK)
+		reportCurlError("Failed to set curl progress callback data",err,errBuf.get());
+	err=curl_easy_setopt(curlSession, CURLOPT_NOPROGRESS, 0L);
+	if(err!=CURLE_OK)
+		reportCurlError("Failed to enable curl progress callback",err,errBuf.get());
+	auto headerList=detail::makeHeaders(options,false);
+	err=curl_easy_setopt(curlSession, CURLOPT_HTTPHEADER, headerList.get());
+	if(err!=CURLE_OK)
+		reportCurlError("Failed to set request headers",err,errBuf.get());
+	detail::setConnectionOptions(curlSession,options,errBuf.get());
+	err=curl_easy_perform(curlSession);
+	//the consumer asking to stop is not an error
+	if(err!=CURLE_OK && err!=CURLE_WRITE_ERROR && err!=CURLE_ABORTED_BY_CALLBACK)
+		reportCurlError("curl perform GET failed",err,errBuf.get());
+		
+	long code;
+	err=curl_easy_getinfo(curlSession,CURLINFO_RESPONSE_CODE,&code);
+	if(err!=CURLE_OK)
+		reportCurlError("Failed to get HTTP response code from curl",err,errBuf.get());
+	assert(code>=0);
+		
+	return Response{(unsigned int)code,data.errorOutput.output};
+}
+
+Client::Client(const ClientOptions& options):pool(new Pool(options)){}
+
+Client::~Client(){}
+
+///A transfer queued or running in an AsyncClient
+struct AsyncTransfer{
+	std::unique_ptr<CURL,void (*)(CURL*)> handle;
+	std::promise<Response> result;
+	detail::CurlOutputData output;
+	///The request body, which curl does not copy
+	std::string body;
+	std::unique_ptr<curl_slist,void (*)(curl_slist*)> headers;
+	char errBuf[CURL_ERROR_SIZE];
+	
+	///\param session the curl handle to use, reset to its default state, of 
+	///               which the transfer takes ownership
+	AsyncTransfer(CURL* session, const std::string& method, const std::string& url, 
+	              std::string body, const Options& options);
+};
+
+AsyncTransfer::AsyncTransfer(CURL* session, const std::string& method, const std::string& url, 
+                             std::string requestBody, const Options& options):
+handle(session,curl_easy_cleanup),
+output{{},method+" "+url},
+body(std::move(requestBody)),
+headers(detail::makeHeaders(options,method=="POST")){
+	using detail::reportCurlError;
+	errBuf[0]=0;
+	if(!handle)
+		throw std::runtime_error("Failed to initialize curl session");
+	CURL* curlSession=handle.get();
+	CURLcode err;
+	err=curl_easy_setopt(curlSession, CURLOPT_ERRORBUFFER, errBuf);
+	if(err!=CURLE_OK)
+		throw std::runtime_error("Failed to set curl error buffer");
+	err=curl_easy_setopt(curlSession, CURLOPT_URL, url.c_str());
+	if(err!=CURLE_OK)
+		reportCurlError("Failed to set curl URL option",err,errBuf);
+	if(method=="POST"){
+		err=curl_easy_setopt(curlSession, CURLOPT_POSTFIELDS, body.c_str());
+		if(err!=CURLE_OK)
+			reportCurlError("Failed to set curl POST data",err,errBuf);
+		err=curl_easy_setopt(curlSession, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)body.size());
+		if(err!=CURLE_OK)
+			reportCurlError("Failed to set curl POST data size",err,errBuf);
+	}
+	else if(method!="GET"){
+		err=curl_easy_setopt(curlSession, CURLOPT_CUSTOMREQUEST, method.c_str());
+		if(err!=CURLE_OK)
+			reportCurlError("Failed to set curl "+method+" option",err,errBuf);
+	}
+	err=curl_easy_setopt(curlSession, CURLOPT_WRITEFUNCTION, detail::collectCurlOutput);
+	if(err!=CURLE_OK)
+		reportCurlError("Failed to set curl output callback",err,errBuf);
+	err=curl_easy_setopt(curlSession, CURLOPT_WRITEDATA, &output);
+	if(err!=CURLE_OK)
+		reportCurlError("Failed to set curl output callback data",err,errBuf);
+	err=curl_easy_setopt(curlSession, CURLOPT_HTTPHEADER, headers.get());
+	if(err!=CURLE_OK)
+		reportCurlError("Failed to set request headers",err,errBuf);
+	err=curl_easy_setopt(curlSession, CURLOPT_PRIVATE, this);
+	if(err!=CURLE_OK)
+		reportCurlError("Failed to set curl private data",err,errBuf);
+	detail::setConnectionOptions(curlSession,options,errBuf);
+}
+
+///The multi handle and event loop thread belonging to an AsyncClient
+struct AsyncClient::Engine{
+	const unsigned int maxInFlight;
+	CURLM* multi;
+	///A pipe whose read end the event loop waits on along with its transfers, 
+	///so that it can be woken when there is new work or it should stop
+	int wakeupPipe[2];
+	std::mutex mut;
+	bool stop;
+	///Handles of finished transfers, kept for reuse. The connections they 
+	///used stay open in the multi handle's connection cache. 
+	std::vector<CURL*> idle;
+	///Transfers waiting for a free slot
+	std::deque<std::unique_ptr<AsyncTransfer>> pending;
+	///Transfers which have been added to the multi handle
+	std::map<CURL*,std::unique_ptr<AsyncTransfer>> running;
+	std::thread loop;
+	
+	explicit Engine(unsigned int maxInFlight);
+	~Engine();
+	std::future<Response> submit(const std::string& method, const std::string& url, 
+	                             std::string body, const Options& options);
+	///Wake the event loop
+	void wakeup();
+	void run();
+	///Deliver the result of a transfer which curl has finished
+	void complete(CURL* handle, CURLcode result);
+};
+
+AsyncClient::Engine::Engine(unsigned int maxInFlight):
+maxInFlight(maxInFlight?maxInFlight:1),multi(curl_multi_init()),stop(false){
+	if(!multi)
+		throw std::runtime_error("Failed to initialize curl multi session");
+	if(pipe2(wakeupPipe,O_NONBLOCK|O_CLOEXEC)!=0){
+		curl_multi_cleanup(multi);
+		throw std::runtime_error("Failed to create wakeup pipe: Error "+std::to_string(errno));
+	}
+	loop=std::thread(&Engine::run,this);
+}
+
+AsyncClient::Engine::~Engine(){
+	{
+		std::lock_guard<std::mutex> lock(mut);
+		stop=true;
+	}
+	wakeup();
+	loop.join();
+	auto abandon=[](AsyncTransfer& transfer){
+		transfer.result.set_exception(std::make_exception_ptr(
+		  std::runtime_error(transfer.output.context+" abandoned")));
+	};
+	for(auto& transfer : pending)
+		abandon(*transfer);
+	for(auto& entry : running){
+		curl_multi_remove_handle(multi,entry.first);
+		abandon(*entry.second);
+	}
+	running.clear();
+	for(CURL* handle : idle)
+		curl_easy_cleanup(handle);
+	curl_multi_cleanup(multi);
+	close(wakeupPipe[0]);
+	close(wakeupPipe[1]);
+}
+
+void AsyncClient::Engine::wakeup(){
+	//if the pipe is full the loop already has a wakeup waiting
+	char signal=0;
+	while(write(wakeupPipe[1],&signal,1)<0 && errno==EINTR);
+}
+
+std::future<Response> AsyncClient::Engine::submit(const std::string& method, const std::string& url, 
+                                                   std::string body, const Options& options){
+	CURL* handle=nullptr;
+	{
+		std::lock_guard<std::mutex> lock(mut);
+		if(stop)
+			throw std::runtime_error("AsyncClient is shutting down");
+		if(!idle.empty()){
+			handle=idle.back();
+			idle.pop_back();
+		}
+	}
+	if(handle)
+		curl_easy_reset(handle);
+	else
+		handle=curl_easy_init();
+	std::unique_ptr<AsyncTransfer> transfer(new AsyncTransfer(handle,method,url,std::move(body),options));
+	std::future<Response> result=transfer->result.get_future();
+	{
+		std::lock_guard<std::mutex> lock(mut);
+		if(stop)
+			throw std::runtime_error("AsyncClient is shutting down");
+		pending.push_back(std::move(transfer));
+	}
+	wakeup();
+	return result;
+}
+
+void AsyncClient::Engine::run(){
+	while(true){
+		{
+			std::lock_guard<std::mutex> lock(mut);
+			if(stop)
+				return;
+			while(!pending.empty() && running.size()<maxInFlight){
+				std::unique_ptr<AsyncTransfer> transfer=std::move(pending.front());
+				pending.pop_front();
+				CURL* handle=transfer->handle.get();
+				CURLMcode err=curl_multi_add_handle(multi,handle);
+				if(err!=CURLM_OK){
+					transfer->result.set_exception(std::make_exception_ptr(std::runtime_error(
+					  transfer->output.context+": failed to start transfer: "+curl_multi_strerror(err))));
+					continue;
+				}
+				running.emplace(handle,std::move(transfer));
+			}
+		}
+		int stillRunning=0;
+		curl_multi_perform(multi,&stillRunning);
+		int remaining=0;
+		while(CURLMsg* message=curl_multi_info_read(multi,&remaining)){
+			if(message->msg==CURLMSG_DONE)
+				complete(message->easy_handle,message->data.result);
+		}
+		curl_waitfd wakeupFD{wakeupPipe[0],CURL_WAIT_POLLIN,0};
+		curl_multi_wait(multi,&wakeupFD,1,1000,nullptr);
+		if(wakeupFD.revents){
+			char buffer[64];
+			while(read(wakeupPipe[0],buffer,sizeof(buffer))>0);
+		}
+	}
+}
+
+void AsyncClient::Engine::complete(CURL* handle, CURLcode result){
+	std::unique_ptr<AsyncTransfer> transfer;
+	{
+		std::lock_guard<std::mutex> lock(mut);
+		auto it=running.find(handle);
+		if(it==running.end())
+			return;
+		transfer=std::move(it->second);
+		running.erase(it);
+	}
+	curl_multi_remove_handle(multi,handle);
+	try{
+		if(result!=CURLE_OK)
+			detail::reportCurlError("curl perform "+transfer->output.context+" failed",result,transfer->errBuf);
+		long code;
+		CURLcode err=curl_easy_getinfo(handle,CURLINFO_RESPONSE_CODE,&code);
+		if(err!=CURLE_OK)
+			detail::reportCurlError("Failed to get HTTP response code from curl",err,transfer->errBuf);
+		assert(code>=0);
+		transfer->result.set_value(Response{(unsigned int)code,std::move(transfer->output.output)});
+	}catch(...){
+		transfer->result.set_exception(std::current_exception());
+	}
+	std::lock_guard<std::mutex> lock(mut);
+	if(idle.size()<maxInFlight)
+		idle.push_back(transfer->handle.release());
+}
+
+AsyncClient::AsyncClient(unsigned int maxInFlight):engine(new Engine(maxInFlight)){}
+
+AsyncClient::~AsyncClient(){}
+
+std::future<Response> AsyncClient::get(const std::string& url, const Options& options){
+	return engine->submit("GET",url,"",options);
+}
+
+std::future<Response> AsyncClient::del(const std::string& url, const Options& options){
+	return engine->submit("DELETE",url,"",options);
+}
+
+std::future<Response> AsyncClient::post(const std::string& url, const std::string& body, 
+                                        const Options& options){
+	return engine->submit("POST",url,body,options);
+}
+
+namespace{
+	std::mutex defaultClientMutex;
+	ClientOptions defaultClientOptions;
+}
+
+void configureDefaultClient(const ClientOptions& options){
+	std::lock_guard<std::mutex> lock(defaultClientMutex);
+	defaultClientOptions=options;
+}
+
+const Client& defaultClient(){
+	//The default client is never destroyed, so that threads which are still 
+	//making requests while the program exits do not use freed handles. 
+	static const Client* client=[]{
+		std::lock_guard<std::mutex> lock(defaultClientMutex);
+		return new Client(defaultClientOptions);
+	}();
+	return *client;
+}
+
+Response httpGet(const std::string& url, const Options& options){
+	return defaultClient().get(url,options);
+}
+
+Response httpDelete(const std::string& url, const Options& options){
+	return defaultClient().del(url,options);
+}
+
+Response httpDelete(const std::string& url, const std::string& body, 
+                    const Options& options){
+	return defaultClient().del(url,body,options);
+}
+
+Response httpPut(const std::string& url, const std::string& body, 
+                 const Options& options){
+	return defaultClient().put(url,body,options);
+}
+
+Response httpPost(const std::string& url, const std::string& body, 
+                  const Options& options){
+	return defaultClient().post(url,body,options);
+}
+
+Response httpPatch(const std::string& url, const std::string& body, 
+                   const Options& options){
+	return defaultClient().patch(url,body,options);
+}
+
+Response httpGetStreaming(const std::string& url, 
+                          const std::function<bool(const char*,std::size_t)>& consumer, 
+                          const Options& options){
+	return defaultClient().getStreaming(url,consumer,options);
+}
+
 } //namespace httpRequests
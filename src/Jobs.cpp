@@ -0,0 +1,224 @@
+#include "Jobs.h"
+
+#include <iostream>
+#include <stdexcept>
+
+#include "Utilities.h"
+
+namespace{
+	const char* stateName(Job::State state){
+		switch(state){
+			case Job::State::Queued: return "queued";
+			case Job::State::Running: return "running";
+			case Job::State::Succeeded: return "succeeded";
+			case Job::State::Failed: return "failed";
+		}
+		return "unknown";
+	}
+
+	const char* stageStateName(Job::StageState state){
+		switch(state){
+			case Job::StageState::Pending: return "pending";
+			case Job::StageState::Running: return "running";
+			case Job::StageState::Done: return "done";
+			case Job::StageState::Skipped: return "skipped";
+			case Job::StageState::Failed: return "failed";
+		}
+		return "unknown";
+	}
+
+	double seconds(std::chrono::steady_clock::duration d){
+		return std::chrono::duration_cast<std::chrono::duration<double>>(d).count();
+	}
+}
+
+Job::Job(const std::string& id, const std::string& key, const std::vector<std::string>& stageNames,
+         const std::string& detail):
+id_(id),key_(key),detail_(detail),state_(State::Queued),created(clock::now()){
+	for(const auto& name : stageNames)
+		stages.push_back(Stage{name,StageState::Pending,{},{},""});
+}
+
+Job::Stage& Job::findStage(const std::string& name){
+	for(auto& stage : stages){
+		if(stage.name==name)
+			return stage;
+	}
+	throw std::logic_error("Job has no stage named "+name);
+}
+
+void Job::runStage(const std::string& name, const std::function<void()>& work){
+	{
+		std::lock_guard<std::mutex> lock(mut);
+		Stage& stage=findStage(name);
+		stage.state=StageState::Running;
+		stage.started=clock::now();
+	}
+	try{
+		work();
+	}catch(std::exception& ex){
+		std::lock_guard<std::mutex> lock(mut);
+		Stage& stage=findStage(name);
+		stage.state=StageState::Failed;
+		stage.finished=clock::now();
+		stage.message=ex.what();
+		throw;
+	}
+	std::lock_guard<std::mutex> lock(mut);
+	Stage& stage=findStage(name);
+	stage.state=StageState::Done;
+	stage.finished=clock::now();
+}
+
+void Job::skipStage(const std::string& name, const std::string& reason){
+	std::lock_guard<std::mutex> lock(mut);
+	Stage& stage=findStage(name);
+	stage.state=StageState::Skipped;
+	stage.message=reason;
+}
+
+void Job::describeStage(const std::string& name, const std::string& message){
+	std::lock_guard<std::mutex> lock(mut);
+	findStage(name).message=message;
+}
+
+Job::State Job::state() const{
+	std::lock_guard<std::mutex> lock(mut);
+	return state_;
+}
+
+bool Job::inProgress() const{
+	State current=state();
+	return current==State::Queued || current==State::Running;
+}
+
+void Job::setState(State state, const std::string& error){
+	std::lock_guard<std::mutex> lock(mut);
+	state_=state;
+	if(state==State::Succeeded || state==State::Failed)
+		finished=clock::now();
+	this->error=error;
+}
+
+std::string Job::statusJSON() const{
+	std::lock_guard<std::mutex> lock(mut);
+	const auto now=clock::now();
+	rapidjson::Document status(rapidjson::kObjectType);
+	rapidjson::Document::AllocatorType& alloc = status.GetAllocator();
+	status.AddMember("id", id_, alloc);
+	status.AddMember("state", rapidjson::StringRef(stateName(state_)), alloc);
+	bool done=(state_==State::Succeeded || state_==State::Failed);
+	status.AddMember("elapsed", seconds((done?finished:now)-created), alloc);
+	if(!error.empty())
+		status.AddMember("error", error, alloc);
+	rapidjson::Value stageList(rapidjson::kArrayType);
+	for(const auto& stage : stages){
+		rapidjson::Value stageData(rapidjson::kObjectType);
+		stageData.AddMember("name", stage.name, alloc);
+		stageData.AddMember("state", rapidjson::StringRef(stageStateName(stage.state)), alloc);
+		if(stage.state==StageState::Running)
+			stageData.AddMember("elapsed", seconds(now-stage.started), alloc);
+		else if(stage.state==StageState::Done || stage.state==StageState::Failed)
+			stageData.AddMember("elapsed", seconds(stage.finished-stage.started), alloc);
+		if(!stage.message.empty())
+			stageData.AddMember("message", stage.message, alloc);
+		stageList.PushBack(stageData, alloc);
+	}
+	status.AddMember("stages", stageList, alloc);
+	return to_string(status);
+}
+
+JobQueue::JobQueue(unsigned int workerCount, std::chrono::seconds retention):
+retention(retention),stop(false),nextID(0){
+	if(!workerCount)
+		workerCount=1;
+	for(unsigned int i=0; i<workerCount; i++)
+		workers.emplace_back(&JobQueue::work,this);
+}
+
+JobQueue::~JobQueue(){
+	{
+		std::lock_guard<std::mutex> lock(mut);
+		stop=true;
+	}
+	cond.notify_all();
+	for(auto& worker : workers)
+		worker.join();
+}
+
+std::shared_ptr<Job> JobQueue::submit(const std::string& key, const std::vector<std::string>& stages,
+                                      std::function<void(Job&)> work, const std::string& detail,
+                                      bool* joined){
+	std::lock_guard<std::mutex> lock(mut);
+	prune();
+	auto existing=jobs.find(key);
+	if(existing!=jobs.end() && existing->second->inProgress()){
+		if(joined)
+			*joined=true;
+		return existing->second;
+	}
+	if(joined)
+		*joined=false;
+	auto job=std::make_shared<Job>(std::to_string(++nextID),key,stages,detail);
+	jobs[key]=job;
+	queue.push_back(Task{job,std::move(work)});
+	cond.notify_one();
+	return job;
+}
+
+std::shared_ptr<Job> JobQueue::find(const std::string& key) const{
+	std::lock_guard<std::mutex> lock(mut);
+	auto it=jobs.find(key);
+	if(it==jobs.end())
+		return nullptr;
+	return it->second;
+}
+
+bool JobQueue::inProgress(const std::string& key) const{
+	auto job=find(key);
+	return job && job->inProgress();
+}
+
+void JobQueue::forget(const std::string& key){
+	std::lock_guard<std::mutex> lock(mut);
+	jobs.erase(key);
+}
+
+void JobQueue::prune(){
+	const auto now=std::chrono::steady_clock::now();
+	for(auto it=jobs.begin(); it!=jobs.end();){
+		bool expired=false;
+		{
+			std::lock_guard<std::mutex> lock(it->second->mut);
+			expired=(it->second->state_==Job::State::Succeeded || it->second->state_==Job::State::Failed)
+			        && now-it->second->finished>retention;
+		}
+		if(expired)
+			it=jobs.erase(it);
+		else
+			++it;
+	}
+}
+
+void JobQueue::work(){
+	while(true){
+		Task task;
+		{
+			std::unique_lock<std::mutex> lock(mut);
+			cond.wait(lock,[this]{ return stop || !queue.empty(); });
+			if(stop)
+				return;
+			task=std::move(queue.front());
+			queue.pop_front();
+		}
+		task.job->setState(Job::State::Running);
+		try{
+			task.work(*task.job);
+			task.job->setState(Job::State::Succeeded);
+		}catch(std::exception& ex){
+			std::cerr << "Job " << task.job->id() << " for " << task.job->key()
+			  << " failed: " << ex.what() << std::endl;
+			task.job->setState(Job::State::Failed,ex.what());
+		}
+	}
+}
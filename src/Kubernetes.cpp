@@ -0,0 +1,372 @@
+#include "Kubernetes.h"
+
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <yaml-cpp/yaml.h>
+
+#include "rapidjson/document.h"
+
+#include "Utilities.h"
+#include "base64.h"
+
+namespace kubernetes{
+
+namespace{
+	const std::string serviceAccountDir="/var/run/secrets/kubernetes.io/serviceaccount";
+
+	bool fileExists(const std::string& path){
+		struct stat info;
+		return stat(path.c_str(),&info)==0;
+	}
+
+	std::string readFile(const std::string& path){
+		std::ifstream in(path);
+		if(!in)
+			throw std::runtime_error("Unable to read "+path);
+		std::ostringstream ss;
+		ss << in.rdbuf();
+		return ss.str();
+	}
+
+	///Write data which was embedded in a kubeconfig to a private file, since
+	///libcurl wants certificates and keys as files.
+	///\return the path to the file
+	std::string writePrivateFile(const std::string& name, const std::string& data){
+		static std::string dir;
+		if(dir.empty()){
+			char dirTemplate[]="/tmp/sandbox-spawner-XXXXXX";
+			if(!mkdtemp(dirTemplate)){
+				int err=errno;
+				throw std::runtime_error("Unable to create directory for kubernetes credentials: Error "+std::to_string(err));
+			}
+			dir=dirTemplate;
+		}
+		std::string path=dir+"/"+name;
+		{
+			std::ofstream out(path);
+			if(!out)
+				throw std::runtime_error("Unable to write "+path);
+			out << data;
+		}
+		chmod(path.c_str(),S_IRUSR|S_IWUSR);
+		return path;
+	}
+
+	///Find the entry with a given name in one of the lists in a kubeconfig
+	///\param list the list of entries (clusters, contexts, or users)
+	///\param name the name of the entry to find
+	///\param field the name of the member of the entry which holds its data
+	YAML::Node findNamed(const YAML::Node& list, const std::string& name, const std::string& field){
+		if(list.IsSequence()){
+			for(const auto& entry : list){
+				if(entry["name"] && entry["name"].as<std::string>()==name)
+					return entry[field];
+			}
+		}
+		throw std::runtime_error("kubeconfig has no "+field+" named '"+name+"'");
+	}
+
+	///Resolve a path from a kubeconfig, which may be relative to the file
+	std::string resolvePath(const std::string& path, const std::string& configPath){
+		if(path.empty() || path[0]=='/')
+			return path;
+		auto slash=configPath.rfind('/');
+		if(slash==std::string::npos)
+			return path;
+		return configPath.substr(0,slash+1)+path;
+	}
+
+	Config parseKubeconfig(const std::string& path){
+		YAML::Node conf;
+		try{
+			conf=YAML::LoadFile(path);
+		}catch(YAML::Exception& ex){
+			throw std::runtime_error("Unable to parse kubeconfig "+path+": "+ex.what());
+		}
+		if(!conf["current-context"])
+			throw std::runtime_error("kubeconfig "+path+" has no current context");
+		std::string contextName=conf["current-context"].as<std::string>();
+		YAML::Node context=findNamed(conf["contexts"],contextName,"context");
+		YAML::Node cluster=findNamed(conf["clusters"],context["cluster"].as<std::string>(),"cluster");
+		YAML::Node user=findNamed(conf["users"],context["user"].as<std::string>(),"user");
+
+		Config config;
+		config.server=cluster["server"].as<std::string>();
+		if(cluster["certificate-authority-data"])
+			config.caBundlePath=writePrivateFile("ca.crt",base64_decode(cluster["certificate-authority-data"].as<std::string>()));
+		else if(cluster["certificate-authority"])
+			config.caBundlePath=resolvePath(cluster["certificate-authority"].as<std::string>(),path);
+		if(user["token"])
+			config.token=user["token"].as<std::string>();
+		else if(user["tokenFile"])
+			config.token=trim(readFile(resolvePath(user["tokenFile"].as<std::string>(),path)));
+		if(user["client-certificate-data"])
+			config.clientCertPath=writePrivateFile("client.crt",base64_decode(user["client-certificate-data"].as<std::string>()));
+		else if(user["client-certificate"])
+			config.clientCertPath=resolvePath(user["client-certificate"].as<std::string>(),path);
+		if(user["client-key-data"])
+			config.clientKeyPath=writePrivateFile("client.key",base64_decode(user["client-key-data"].as<std::string>()));
+		else if(user["client-key"])
+			config.clientKeyPath=resolvePath(user["client-key"].as<std::string>(),path);
+		return config;
+	}
+
+	Config inClusterConfig(){
+		std::string host, port;
+		fetchFromEnvironment("KUBERNETES_SERVICE_HOST",host);
+		fetchFromEnvironment("KUBERNETES_SERVICE_PORT",port);
+		Config config;
+		if(host.find(':')!=std::string::npos) //IPv6 address
+			host='['+host+']';
+		config.server="https://"+host+":"+port;
+		config.token=trim(readFile(serviceAccountDir+"/token"));
+		config.caBundlePath=serviceAccountDir+"/ca.crt";
+		return config;
+	}
+
+	std::string urlEncode(const std::string& raw){
+		const static char hex[]="0123456789ABCDEF";
+		std::string result;
+		for(unsigned char c : raw){
+			if(std::isalnum(c) || c=='-' || c=='_' || c=='.' || c=='~')
+				result+=c;
+			else{
+				result+='%';
+				result+=hex[c>>4];
+				result+=hex[c&0xF];
+			}
+		}
+		return result;
+	}
+	
+	///Split a YAML manifest into its non-empty documents
+	///\return each document parsed, paired with its original text
+	///\throws std::runtime_error if a document cannot be parsed, or lacks a 
+	///        kind or namespace
+	std::vector<std::pair<YAML::Node,std::string>> splitManifests(const std::string& manifests){
+		std::vector<std::pair<YAML::Node,std::string>> documents;
+		std::size_t pos=0;
+		while(pos<manifests.size()){
+			//find the next document separator, which must be on a line by itself
+			std::size_t end=manifests.find("\n---",pos);
+			while(end!=std::string::npos && end+4<manifests.size() && manifests[end+4]!='\n')
+				end=manifests.find("\n---",end+1);
+			std::string document=manifests.substr(pos,end==std::string::npos?end:end+1-pos);
+			pos=(end==std::string::npos?manifests.size():end+4);
+			
+			YAML::Node object;
+			try{
+				object=YAML::Load(document);
+			}catch(YAML::Exception& ex){
+				throw std::runtime_error(std::string("Unable to parse manifest: ")+ex.what());
+			}
+			if(!object.IsMap()) //empty document
+				continue;
+			if(!object["kind"] || !object["metadata"] || !object["metadata"]["namespace"])
+				throw std::runtime_error("Manifest is missing kind or namespace");
+			documents.emplace_back(object,std::move(document));
+		}
+		return documents;
+	}
+	
+	///Operations on a single object must never be given an empty name, since 
+	///the request would then be made to the URL of the whole collection
+	///\throws std::runtime_error if \p name is empty
+	void requireName(const std::string& name){
+		if(name.empty())
+			throw std::runtime_error("Kubernetes object name must not be empty");
+	}
+}
+
+Config loadConfig(const std::string& kubeconfigPath){
+	if(!kubeconfigPath.empty())
+		return parseKubeconfig(kubeconfigPath);
+	std::string envPath;
+	if(fetchFromEnvironment("KUBECONFIG",envPath) && !envPath.empty()){
+		//like kubectl, accept a list of files, but only use the first which exists
+		for(const auto& path : string_split_columns(envPath,':',false)){
+			if(fileExists(path))
+				return parseKubeconfig(path);
+		}
+	}
+	std::string home;
+	if(fetchFromEnvironment("HOME",home) && fileExists(home+"/.kube/config"))
+		return parseKubeconfig(home+"/.kube/config");
+	std::string host;
+	if(fetchFromEnvironment("KUBERNETES_SERVICE_HOST",host) && fileExists(serviceAccountDir+"/token"))
+		return inClusterConfig();
+	throw std::runtime_error("Unable to find a kubeconfig or in-cluster service account");
+}
+
+Kind kindFromString(const std::string& kind){
+	if(kind=="Pod")
+		return Kind::Pod;
+	if(kind=="Service")
+		return Kind::Service;
+	if(kind=="Deployment")
+		return Kind::Deployment;
+	if(kind=="Secret")
+		return Kind::Secret;
+	throw std::runtime_error("Unsupported kubernetes object kind: "+kind);
+}
+
+std::string errorMessage(const httpRequests::Response& response){
+	rapidjson::Document status;
+	status.Parse(response.body.c_str());
+	if(!status.HasParseError() && status.IsObject() && status.HasMember("message")
+	   && status["message"].IsString())
+		return status["message"].GetString();
+	return response.body;
+}
+
+Client::Client(const Config& config):server(config.server){
+	while(!server.empty() && server.back()=='/')
+		server.pop_back();
+	baseOptions.caBundlePath=config.caBundlePath;
+	baseOptions.clientCertPath=config.clientCertPath;
+	baseOptions.clientKeyPath=config.clientKeyPath;
+	baseOptions.bearerToken=config.token;
+}
+
+std::string Client::objectURL(Kind kind, const std::string& ns, const std::string& name) const{
+	std::string url=server;
+	switch(kind){
+		case Kind::Pod:
+			url+="/api/v1/namespaces/"+ns+"/pods";
+			break;
+		case Kind::Service:
+			url+="/api/v1/namespaces/"+ns+"/services";
+			break;
+		case Kind::Secret:
+			url+="/api/v1/namespaces/"+ns+"/secrets";
+			break;
+		case Kind::Deployment:
+			url+="/apis/apps/v1/namespaces/"+ns+"/deployments";
+			break;
+	}
+	if(!name.empty())
+		url+="/"+name;
+	return url;
+}
+
+httpRequests::Response Client::get(Kind kind, const std::string& ns, const std::string& name) const{
+	requireName(name);
+	return httpRequests::httpGet(objectURL(kind,ns,name),baseOptions);
+}
+
+httpRequests::Response Client::list(Kind kind, const std::string& ns, const std::string& labelSelector) const{
+	std::string url=objectURL(kind,ns);
+	if(!labelSelector.empty())
+		url+="?labelSelector="+urlEncode(labelSelector);
+	return httpRequests::httpGet(url,baseOptions);
+}
+
+httpRequests::Response Client::watch(Kind kind, const std::string& ns, const std::string& labelSelector, 
+                                     const std::string& resourceVersion, 
+                                     const std::function<bool(const std::string&, const rapidjson::Value&)>& handler, 
+                                     unsigned int timeout, const std::function<bool()>& stopped) const{
+	std::string url=objectURL(kind,ns)+"?watch=1&allowWatchBookmarks=true&timeoutSeconds="+std::to_string(timeout);
+	if(!resourceVersion.empty())
+		url+="&resourceVersion="+urlEncode(resourceVersion);
+	if(!labelSelector.empty())
+		url+="&labelSelector="+urlEncode(labelSelector);
+	httpRequests::Options options=baseOptions;
+	//allow some slack for the server to end the watch itself
+	options.timeout=timeout+30;
+	//events are newline delimited JSON objects, which may be split across or 
+	//combined within the chunks of data we receive
+	std::string partial;
+	auto consumer=[&](const char* data, std::size_t size)->bool{
+		if(stopped && stopped())
+			return false;
+		if(!size)
+			return true;
+		partial.append(data,size);
+		std::size_t start=0, end;
+		while((end=partial.find('\n',start))!=std::string::npos){
+			rapidjson::Document event;
+			event.Parse(partial.c_str()+start,end-start);
+			start=end+1;
+			if(event.HasParseError() || !event.IsObject() || !event.HasMember("type") 
+			   || !event["type"].IsString() || !event.HasMember("object"))
+				continue;
+			if(!handler(event["type"].GetString(),event["object"]))
+				return false;
+		}
+		partial.erase(0,start);
+		return true;
+	};
+	return httpRequests::httpGetStreaming(url,consumer,options);
+}
+
+httpRequests::Response Client::create(Kind kind, const std::string& ns, const std::string& manifest) const{
+	httpRequests::Options options=baseOptions;
+	//YAML is a superset of JSON, and the API server accepts either
+	options.contentType="application/yaml";
+	return httpRequests::httpPost(objectURL(kind,ns),manifest,options);
+}
+
+httpRequests::Response Client::patch(Kind kind, const std::string& ns, const std::string& name, 
+                                     const std::string& patch, const std::string& patchType) const{
+	requireName(name);
+	httpRequests::Options options=baseOptions;
+	options.contentType=patchType;
+	return httpRequests::httpPatch(objectURL(kind,ns,name),patch,options);
+}
+
+httpRequests::Response Client::remove(Kind kind, const std::string& ns, const std::string& name, 
+                                      const std::string& propagationPolicy, 
+                                      const std::string& uid) const{
+	requireName(name);
+	std::string url=objectURL(kind,ns,name);
+	if(!propagationPolicy.empty())
+		url+="?propagationPolicy="+propagationPolicy;
+	if(uid.empty())
+		return httpRequests::httpDelete(url,baseOptions);
+	rapidjson::Document deleteOptions(rapidjson::kObjectType);
+	rapidjson::Document::AllocatorType& alloc = deleteOptions.GetAllocator();
+	deleteOptions.AddMember("kind", "DeleteOptions", alloc);
+	deleteOptions.AddMember("apiVersion", "v1", alloc);
+	rapidjson::Value preconditions(rapidjson::kObjectType);
+	preconditions.AddMember("uid", rapidjson::StringRef(uid.c_str()), alloc);
+	deleteOptions.AddMember("preconditions", preconditions, alloc);
+	httpRequests::Options options=baseOptions;
+	options.contentType="application/json";
+	return httpRequests::httpDelete(url,to_string(deleteOptions),options);
+}
+
+httpRequests::Response Client::apply(Kind kind, const std::string& ns, const std::string& name, 
+                                     const std::string& manifest, const std::string& fieldManager) const{
+	requireName(name);
+	httpRequests::Options options=baseOptions;
+	options.contentType="application/apply-patch+yaml";
+	return httpRequests::httpPatch(objectURL(kind,ns,name)+"?fieldManager="+fieldManager+"&force=true",
+	                               manifest,options);
+}
+
+httpRequests::Response Client::applyAll(const std::string& manifests) const{
+	httpRequests::Response result{0,""};
+	for(const auto& document : splitManifests(manifests)){
+		if(!document.first["metadata"]["name"])
+			throw std::runtime_error("Manifest is missing name");
+		result=apply(kindFromString(document.first["kind"].as<std::string>()),
+		             document.first["metadata"]["namespace"].as<std::string>(),
+		             document.first["metadata"]["name"].as<std::string>(),document.second);
+		if(result.status!=200 && result.status!=201)
+			return result;
+	}
+	return result;
+}
+
+} //namespace kubernetes
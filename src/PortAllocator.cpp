@@ -0,0 +1,134 @@
+#include "PortAllocator.h"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "Utilities.h"
+
+namespace{
+	const unsigned int bitsPerWord=64;
+
+	unsigned int parsePort(const std::string& text){
+		std::size_t end=0;
+		unsigned long port=0;
+		try{
+			port=std::stoul(text,&end);
+		}catch(std::logic_error&){
+			end=0;
+		}
+		if(end==0 || end!=text.size() || port==0 || port>65535)
+			throw std::runtime_error("Invalid port number: '"+text+"'");
+		return port;
+	}
+
+	///Parse a list like "5000-5999,6100,7000-7010" into inclusive ranges
+	std::vector<std::pair<unsigned int,unsigned int>> parseRanges(const std::string& list){
+		std::vector<std::pair<unsigned int,unsigned int>> ranges;
+		for(const std::string& item : string_split_columns(list,',',false)){
+			std::string range=trim(item);
+			if(range.empty())
+				continue;
+			auto dash=range.find('-');
+			if(dash==std::string::npos){
+				unsigned int port=parsePort(range);
+				ranges.emplace_back(port,port);
+				continue;
+			}
+			unsigned int first=parsePort(trim(range.substr(0,dash)));
+			unsigned int last=parsePort(trim(range.substr(dash+1)));
+			if(last<first)
+				throw std::runtime_error("Invalid port range: '"+range+"'");
+			ranges.emplace_back(first,last);
+		}
+		return ranges;
+	}
+}
+
+PortAllocator::PortAllocator(const std::string& rangeList, const std::string& exclusionList):
+hint(0){
+	auto ranges=parseRanges(rangeList);
+	if(ranges.empty())
+		throw std::runtime_error("No port ranges configured");
+	unsigned int first=std::numeric_limits<unsigned int>::max(), last=0;
+	for(const auto& range : ranges){
+		first=std::min(first,range.first);
+		last=std::max(last,range.second);
+	}
+	base=first;
+	span=last-first+1;
+	wordCount=(span+bitsPerWord-1)/bitsPerWord;
+	used.reset(new std::atomic<std::uint64_t>[wordCount]);
+	allowed.reset(new std::uint64_t[wordCount]);
+	std::fill(allowed.get(),allowed.get()+wordCount,0);
+
+	auto setAllowed=[this](const std::pair<unsigned int,unsigned int>& range, bool value){
+		for(unsigned int port=std::max(range.first,base); port<=range.second && port-base<span; port++){
+			std::uint64_t bit=std::uint64_t(1)<<((port-base)%bitsPerWord);
+			if(value)
+				allowed[(port-base)/bitsPerWord]|=bit;
+			else
+				allowed[(port-base)/bitsPerWord]&=~bit;
+		}
+	};
+	for(const auto& range : ranges)
+		setAllowed(range,true);
+	for(const auto& range : parseRanges(exclusionList))
+		setAllowed(range,false);
+	//ports which are not allowed are permanently marked as used, so that the
+	//search for a free port need not consider them separately
+	for(std::size_t i=0; i<wordCount; i++)
+		used[i].store(~allowed[i],std::memory_order_relaxed);
+	if(!available())
+		throw std::runtime_error("No ports are available for allocation");
+}
+
+unsigned int PortAllocator::reserve(){
+	const std::size_t start=hint.load(std::memory_order_relaxed)%wordCount;
+	for(std::size_t i=0; i<wordCount; i++){
+		const std::size_t index=(start+i)%wordCount;
+		std::uint64_t word=used[index].load(std::memory_order_relaxed);
+		while(~word){
+			unsigned int bit=__builtin_ctzll(~word);
+			if(used[index].compare_exchange_weak(word,word|(std::uint64_t(1)<<bit),
+			                                     std::memory_order_acq_rel,
+			                                     std::memory_order_relaxed)){
+				hint.store(index,std::memory_order_relaxed);
+				return base+index*bitsPerWord+bit;
+			}
+			//on failure word has been updated to the current value; try again
+		}
+	}
+	throw std::runtime_error("port range exhausted");
+}
+
+bool PortAllocator::claim(unsigned int port){
+	if(port<base || port-base>=span)
+		return false;
+	const std::size_t index=(port-base)/bitsPerWord;
+	const std::uint64_t bit=std::uint64_t(1)<<((port-base)%bitsPerWord);
+	return !(used[index].fetch_or(bit,std::memory_order_acq_rel)&bit);
+}
+
+void PortAllocator::release(unsigned int port){
+	if(port<base || port-base>=span)
+		return;
+	const std::size_t index=(port-base)/bitsPerWord;
+	const std::uint64_t bit=std::uint64_t(1)<<((port-base)%bitsPerWord);
+	if(!(allowed[index]&bit))
+		return;
+	used[index].fetch_and(~bit,std::memory_order_acq_rel);
+	//make the freed port visible to the next search promptly
+	std::size_t current=hint.load(std::memory_order_relaxed);
+	if(index<current)
+		hint.compare_exchange_strong(current,index,std::memory_order_relaxed);
+}
+
+std::size_t PortAllocator::available() const{
+	std::size_t count=0;
+	for(std::size_t i=0; i<wordCount; i++)
+		count+=__builtin_popcountll(~used[i].load(std::memory_order_relaxed));
+	return count;
+}
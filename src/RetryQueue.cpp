@@ -0,0 +1,75 @@
+#include "RetryQueue.h"
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+RetryQueue::RetryQueue(Task task, unsigned int workerCount,
+                       std::chrono::seconds minDelay, std::chrono::seconds maxDelay):
+task(std::move(task)),minDelay(minDelay),maxDelay(std::max(minDelay,maxDelay)),stop(false){
+	if(!workerCount)
+		workerCount=1;
+	for(unsigned int i=0; i<workerCount; i++)
+		workers.emplace_back(&RetryQueue::work,this);
+}
+
+RetryQueue::~RetryQueue(){
+	{
+		std::lock_guard<std::mutex> lock(mut);
+		stop=true;
+	}
+	cond.notify_all();
+	for(auto& worker : workers)
+		worker.join();
+}
+
+void RetryQueue::add(const std::string& key){
+	{
+		std::lock_guard<std::mutex> lock(mut);
+		if(delays.count(key))
+			return;
+		delays.emplace(key,minDelay);
+		schedule.emplace(clock::now(),key);
+	}
+	cond.notify_one();
+}
+
+std::size_t RetryQueue::pending() const{
+	std::lock_guard<std::mutex> lock(mut);
+	return delays.size();
+}
+
+void RetryQueue::work(){
+	std::unique_lock<std::mutex> lock(mut);
+	while(true){
+		if(stop)
+			return;
+		if(schedule.empty()){
+			cond.wait(lock);
+			continue;
+		}
+		if(schedule.begin()->first>clock::now()){
+			cond.wait_until(lock,schedule.begin()->first);
+			continue;
+		}
+		std::string key=schedule.begin()->second;
+		schedule.erase(schedule.begin());
+		lock.unlock();
+		std::string error;
+		try{
+			task(key);
+		}catch(std::exception& ex){
+			error=ex.what();
+		}
+		lock.lock();
+		auto delay=delays.find(key);
+		if(error.empty()){
+			delays.erase(delay);
+			continue;
+		}
+		std::cerr << "Task for " << key << " failed: " << error
+		  << "; retrying in " << delay->second.count() << " seconds" << std::endl;
+		schedule.emplace(clock::now()+delay->second,key);
+		delay->second=std::min(delay->second*2,maxDelay);
+	}
+}
@@ -0,0 +1,66 @@
+#include "Template.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace{
+	bool isNameCharacter(char c){
+		return (c>='a' && c<='z') || (c>='0' && c<='9') || c=='-';
+	}
+}
+
+Template::Template(std::string templateText):text(std::move(templateText)){
+	std::size_t literalStart=0, pos=0;
+	while((pos=text.find("{{",pos))!=std::string::npos){
+		std::size_t nameStart=pos+2, nameEnd=nameStart;
+		while(nameEnd<text.size() && isNameCharacter(text[nameEnd]))
+			nameEnd++;
+		if(nameEnd==nameStart || text.compare(nameEnd,2,"}}")!=0){
+			//not a placeholder
+			pos++;
+			continue;
+		}
+		std::string name=text.substr(nameStart,nameEnd-nameStart);
+		auto slot=std::find(slots.begin(),slots.end(),name);
+		if(slot==slots.end())
+			slot=slots.insert(slots.end(),name);
+		segments.push_back(Segment{literalStart,pos-literalStart,int(slot-slots.begin())});
+		literalStart=pos=nameEnd+2;
+	}
+	segments.push_back(Segment{literalStart,text.size()-literalStart,-1});
+}
+
+Template Template::load(const std::string& path){
+	std::ifstream file(path);
+	if(!file)
+		throw std::runtime_error("Unable to open template file "+path);
+	std::ostringstream contents;
+	contents << file.rdbuf();
+	if(file.bad())
+		throw std::runtime_error("Unable to read template file "+path);
+	return Template(contents.str());
+}
+
+std::string Template::render(const std::map<std::string,std::string>& values) const{
+	//look up each placeholder once, however many times it appears
+	std::vector<const std::string*> slotValues(slots.size());
+	for(std::size_t i=0; i<slots.size(); i++){
+		auto it=values.find(slots[i]);
+		if(it==values.end())
+			throw std::runtime_error("No value for template placeholder {{"+slots[i]+"}}");
+		slotValues[i]=&it->second;
+	}
+	std::size_t size=0;
+	for(const auto& segment : segments)
+		size+=segment.length+(segment.slot>=0?slotValues[segment.slot]->size():0);
+	std::string result;
+	result.reserve(size);
+	for(const auto& segment : segments){
+		result.append(text,segment.offset,segment.length);
+		if(segment.slot>=0)
+			result.append(*slotValues[segment.slot]);
+	}
+	return result;
+}
@@ -2,8 +2,6 @@
 
 #include <boost/date_time/posix_time/posix_time.hpp>
 
-#include "Process.h"
-
 std::string timestamp(){
 	auto now = boost::posix_time::second_clock::universal_time();
 	return to_simple_string(now)+" UTC";
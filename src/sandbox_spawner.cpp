@@ -1,23 +1,24 @@
+#include <algorithm>
 #include <cerrno>
-#include <cstdio> //for rename, remove
-#include <fstream>
+#include <condition_variable>
+#include <cstdio>
+#include <ctime>
+#include <exception>
+#include <future>
 #include <iostream>
 #include <mutex>
 #include <random>
+#include <set>
 #include <string>
 #include <map>
-#include <set>
+#include <memory>
+#include <vector>
 
 #define CROW_ENABLE_SSL
 #include <crow.h>
 
 #include <boost/optional.hpp>
 
-#include <boost/archive/text_iarchive.hpp>
-#include <boost/archive/text_oarchive.hpp>
-#include <boost/serialization/nvp.hpp>
-#include <boost/serialization/map.hpp>
-
 #include <boost/uuid/uuid.hpp>
 #include <boost/uuid/uuid_io.hpp>
 #include <boost/uuid/random_generator.hpp>
@@ -26,8 +27,16 @@
 #include "rapidjson/writer.h"
 #include "rapidjson/stringbuffer.h"
 
+#include <ClusterState.h>
+#include <DataStore.h>
+#include <EndpointCache.h>
+#include <Jobs.h>
 #include <HTTPRequests.h>
-#include <Process.h>
+#include <Kubernetes.h>
+#include <Manifests.h>
+#include <PortAllocator.h>
+#include <RetryQueue.h>
+#include <Template.h>
 #include <Utilities.h>
 #include <base64.h>
 
@@ -39,6 +48,27 @@ struct Configuration{
 	std::string slateEndpoint;
 	std::string slateAdminToken;
 	std::string dataStorePath;
+	std::string dataStoreSyncInterval;
+	std::string dataStoreCompactionThreshold;
+	std::string kubeconfig;
+	std::string portRanges;
+	std::string excludedPorts;
+	std::string warmPoolSize;
+	std::string provisioningWorkers;
+	std::string maxRequestsPerHost;
+	std::string idleConnections;
+	std::string maxConcurrentSlateRequests;
+	std::string secretTemplateFile;
+	std::string deploymentTemplateFile;
+	std::string serviceTemplateFile;
+	std::string poolTemplateFile;
+	std::string podDiscoveryTimeout;
+	std::string endpointCacheTTL;
+	std::string deletionWorkers;
+	std::string idleTimeout;
+	std::string reconcileInterval;
+	std::string removeOrphansWithoutData;
+	std::string poolClaimURL;
 	
 	std::map<std::string,std::string&> options;
 	
@@ -48,6 +78,20 @@ struct Configuration{
 	slateEndpoint("http://sandbox.slateci.io:18080"),
 	slateAdminToken("3acc9bdc-1243-40ea-96df-373c8a616a16"),
 	dataStorePath("data"),
+	dataStoreSyncInterval("0"),
+	dataStoreCompactionThreshold("1000"),
+	portRanges("5000-9999"),
+	warmPoolSize("0"),
+	provisioningWorkers("4"),
+	maxRequestsPerHost("0"),
+	idleConnections("16"),
+	maxConcurrentSlateRequests("8"),
+	podDiscoveryTimeout("300"),
+	endpointCacheTTL("60"),
+	deletionWorkers("2"),
+	idleTimeout("0"),
+	reconcileInterval("600"),
+	removeOrphansWithoutData("false"),
 	options{
 		{"port",portString},
 		{"dnsName",dnsName},
@@ -56,6 +100,27 @@ struct Configuration{
 		{"slateEndpoint",slateEndpoint},
 		{"slateAdminToken",slateAdminToken},
 		{"dataStorePath",dataStorePath},
+		{"dataStoreSyncInterval",dataStoreSyncInterval},
+		{"dataStoreCompactionThreshold",dataStoreCompactionThreshold},
+		{"kubeconfig",kubeconfig},
+		{"portRanges",portRanges},
+		{"excludedPorts",excludedPorts},
+		{"warmPoolSize",warmPoolSize},
+		{"provisioningWorkers",provisioningWorkers},
+		{"maxRequestsPerHost",maxRequestsPerHost},
+		{"idleConnections",idleConnections},
+		{"maxConcurrentSlateRequests",maxConcurrentSlateRequests},
+		{"secretTemplateFile",secretTemplateFile},
+		{"deploymentTemplateFile",deploymentTemplateFile},
+		{"serviceTemplateFile",serviceTemplateFile},
+		{"poolTemplateFile",poolTemplateFile},
+		{"podDiscoveryTimeout",podDiscoveryTimeout},
+		{"endpointCacheTTL",endpointCacheTTL},
+		{"deletionWorkers",deletionWorkers},
+		{"idleTimeout",idleTimeout},
+		{"reconcileInterval",reconcileInterval},
+		{"removeOrphansWithoutData",removeOrphansWithoutData},
+		{"poolClaimURL",poolClaimURL},
 	}
 	{
 		//check for environment variables
@@ -87,31 +152,17 @@ struct Configuration{
 	}
 };
 
-struct UserData{
-	std::string deploymentName;
-	std::string podName;
-	std::string serviceName;
-	unsigned int servicePort;
-	std::string secretName;
-	std::string authToken;
-	std::string slateID;
-	std::string slateToken;
-	
-	template<typename Archive>
-	void serialize(Archive& ar, const unsigned int file_version);
-};
-
-template<typename Archive>
-void UserData::serialize(Archive& ar, const unsigned int file_version){
-	using boost::serialization::make_nvp;
-	ar & make_nvp("deployment",deploymentName);
-	ar & make_nvp("pod",podName);
-	ar & make_nvp("service",serviceName);
-	ar & make_nvp("port",servicePort);
-	ar & make_nvp("secret",secretName);
-	ar & make_nvp("auth",authToken);
-	ar & make_nvp("slateID",slateID);
-	ar & make_nvp("slateToken",slateToken);
+///Interpret a configuration option as a non-negative integer
+///\param name the name of the option, for use in error messages
+///\param value the value of the option
+///\throws std::runtime_error if the value is not a valid number
+unsigned int parseUnsignedOption(const std::string& name, const std::string& value){
+	std::istringstream is(value);
+	unsigned int result;
+	is >> result;
+	if(is.fail() || !is.eof() || value.empty() || value[0]=='-')
+		throw std::runtime_error("Unable to parse \""+value+"\" as a value for "+name);
+	return result;
 }
 
 struct TokenGenerator{
@@ -126,415 +177,1729 @@ private:
 	boost::uuids::random_generator gen;
 } tokenGenerator;
 
-class DataStore{
+const static std::string sandboxNamespace="tutorial";
+
+const static std::string poolName="sandbox-pool";
+const static std::string authAnnotation="sandbox.slateci.io/auth";
+const static std::string slateTokenAnnotation="sandbox.slateci.io/slate-token";
+const static std::string slateEndpointAnnotation="sandbox.slateci.io/slate-endpoint";
+
+///The manifests from which users' objects and the warm pool are created, 
+///compiled once at startup. Each is the built-in template unless a file to 
+///load it from is configured. 
+struct ManifestTemplates{
+	Template secret;
+	Template deployment;
+	Template service;
+	Template pool;
+	
+	///\throws std::runtime_error if a template file cannot be read, or 
+	///        contains a placeholder which will have no value
+	explicit ManifestTemplates(const Configuration& config):
+	secret(loadTemplate(config.secretTemplateFile,secretTemplate,accountPlaceholders)),
+	deployment(loadTemplate(config.deploymentTemplateFile,deploymentTemplate,accountPlaceholders)),
+	service(loadTemplate(config.serviceTemplateFile,serviceTemplate,accountPlaceholders)),
+	pool(loadTemplate(config.poolTemplateFile,poolTemplate,poolPlaceholders)){}
+	
+private:
+	static Template loadTemplate(const std::string& path, const std::string& builtIn, 
+	                             const std::vector<std::string>& allowed){
+		if(path.empty())
+			return Template(builtIn);
+		Template result=Template::load(path);
+		for(const auto& name : result.placeholders()){
+			if(std::find(allowed.begin(),allowed.end(),name)==allowed.end())
+				throw std::runtime_error("Template "+path+" uses unknown placeholder {{"+name+"}}");
+		}
+		std::cout << "Loaded manifest template from " << path << std::endl;
+		return result;
+	}
+};
+
+///The values of the placeholders in a user's manifests
+///\param account the user's record, which must have its SLATE token
+std::map<std::string,std::string> accountManifestValues(const Configuration& config, const std::string& globusID, 
+                                                        const UserData& account){
+	return {
+		{"name","ttyd-"+globusID},
+		{"auth",account.authToken},
+		{"external-port",std::to_string(account.servicePort)},
+		{"slate-token",base64_encode(account.slateToken.c_str(),account.slateToken.size())},
+		{"slate-endpoint",base64_encode(config.slateEndpoint.c_str(),config.slateEndpoint.size())},
+	};
+}
+
+///Create a kubernetes object from a manifest, by server-side apply so that an 
+///object left behind by an earlier, interrupted attempt is taken over rather 
+///than causing a conflict
+///\return the API response, whose body is the created object
+///\throws std::runtime_error if creation fails
+httpRequests::Response createObject(const kubernetes::Client& kube, const std::string& manifest){
+	auto result=kube.applyAll(manifest);
+	if(result.status!=200 && result.status!=201)
+		throw std::runtime_error(kubernetes::errorMessage(result));
+	return result;
+}
+
+///A set of generic sandbox pods which are started in advance, so that new 
+///users do not have to wait for a pod to be scheduled and its image pulled. 
+class WarmPool{
 public:
-	DataStore(const std::string dataPath):persistentPath(dataPath){
-		loadData();
+	///\param kube the client used to talk to the API server
+	///\param size the number of pods to keep ready, or zero to disable the pool
+	///\param manifest the template for the pool's deployment
+	///\param claimURL the URL, reachable from the pool's pods, under which 
+	///                they fetch their credentials from the spawner
+	WarmPool(const kubernetes::Client& kube, const Template& manifest, unsigned int size, 
+	         const std::string& claimURL):
+	kube(kube),manifest(manifest),size(size),claimURL(claimURL){}
+	
+	///Create the pool's deployment, or bring its size up to date if it already 
+	///exists. If the pool is disabled, remove any deployment left from when it 
+	///was enabled. 
+	void setUp(){
+		if(!size){
+			auto result=kube.deleteDeployment(sandboxNamespace,poolName);
+			if(result.status==200)
+				std::cout << "Removed warm pool" << std::endl;
+			else if(result.status!=404)
+				std::cerr << "Unable to remove warm pool: " << kubernetes::errorMessage(result) << std::endl;
+			return;
+		}
+		//applying the manifest both creates the deployment and updates the 
+		//size of one left from an earlier run
+		auto result=kube.applyAll(manifest.render({{"pool-size",std::to_string(size)},{"claim-url",claimURL}}));
+		if(result.status!=200 && result.status!=201)
+			throw std::runtime_error("Unable to set up warm pool: "+kubernetes::errorMessage(result));
+		std::cout << "Keeping " << size << " sandbox pods warm" << std::endl;
 	}
 	
-	boost::optional<UserData> find(const std::string& globusID){
-		std::lock_guard<std::mutex> lock(mut);
-		auto it=podMap.find(globusID);
-		if(it==podMap.end())
+	///Try to take a pod from the pool for a user. The pod is relabeled, so 
+	///that it is selected by the user's service rather than the pool's 
+	///deployment (which starts a replacement), and given the user's 
+	///credentials, which cause it to start ttyd once it collects them. 
+	///\param name the name used for the user's objects
+	///\param account the user's details
+	///\param slateEndpoint the SLATE API endpoint which the user should use
+	///\return the name of the pod claimed, or nothing if no pod was available
+	boost::optional<std::string> claim(const std::string& name, const UserData& account, 
+	                                   const std::string& slateEndpoint){
+		if(!size)
 			return {};
-		return it->second;
+		auto result=kube.listPods(sandboxNamespace,"app="+poolName);
+		if(result.status!=200){
+			std::cerr << "Unable to list warm pool: " << kubernetes::errorMessage(result) << std::endl;
+			return {};
+		}
+		rapidjson::Document listing;
+		listing.Parse(result.body);
+		if(listing.HasParseError() || !listing.HasMember("items") || !listing["items"].IsArray())
+			return {};
+		//only pods which are already running save any time
+		std::vector<std::pair<std::string,std::string>> candidates; //name, resourceVersion
+		for(const auto& pod : listing["items"].GetArray()){
+			try{
+				PodState state=parsePodState(pod);
+				if(!state.running || state.terminating || !pod["metadata"].HasMember("resourceVersion"))
+					continue;
+				candidates.emplace_back(state.name,pod["metadata"]["resourceVersion"].GetString());
+			}catch(std::runtime_error& err){
+				continue;
+			}
+		}
+		//concurrent claims are less likely to collide if they try the pods in 
+		//different orders
+		static thread_local std::mt19937 rng(std::random_device{}());
+		std::shuffle(candidates.begin(),candidates.end(),rng);
+		
+		for(const auto& candidate : candidates){
+			rapidjson::Document patch(rapidjson::kObjectType);
+			rapidjson::Document::AllocatorType& alloc = patch.GetAllocator();
+			rapidjson::Value metadata(rapidjson::kObjectType);
+			//the claim fails if someone else has modified the pod first
+			metadata.AddMember("resourceVersion", candidate.second, alloc);
+			rapidjson::Value labels(rapidjson::kObjectType);
+			labels.AddMember("app", name, alloc);
+			labels.AddMember("pod-template-hash", rapidjson::Value(), alloc);
+			metadata.AddMember("labels", labels, alloc);
+			const std::map<std::string,std::string> credentials={
+				{authAnnotation,account.authToken},
+				{slateTokenAnnotation,base64_encode(account.slateToken.c_str(),account.slateToken.size())},
+				{slateEndpointAnnotation,base64_encode(slateEndpoint.c_str(),slateEndpoint.size())},
+			};
+			rapidjson::Value annotations(rapidjson::kObjectType);
+			for(const auto& credential : credentials)
+				annotations.AddMember(rapidjson::StringRef(credential.first.c_str()), credential.second, alloc);
+			metadata.AddMember("annotations", annotations, alloc);
+			patch.AddMember("metadata", metadata, alloc);
+			
+			result=kube.patchPod(sandboxNamespace,candidate.first,to_string(patch));
+			if(result.status==200){
+				offerCredentials(candidate.first,result.body,credentials);
+				return candidate.first;
+			}
+			if(result.status==409 || result.status==404) //claimed by someone else
+				continue;
+			std::cerr << "Unable to claim pool pod " << candidate.first << ": " 
+			  << kubernetes::errorMessage(result) << std::endl;
+			break;
+		}
+		return {};
 	}
 	
-	void record(const std::string& globusID, const UserData& data){
-		std::lock_guard<std::mutex> lock(mut);
-		podMap[globusID]=data;
-		usedPorts.insert(data.servicePort);
-		saveData();
+	///Hand a claimed pod its credentials. Each pod's credentials can be 
+	///collected once. 
+	///\param podName the name of the pod
+	///\param uid the UID which the pod reports for itself
+	///\return the credentials, in the same format as the downward API's 
+	///        annotations file, or nothing if the pod has not been claimed, or 
+	///        its credentials have already been collected or have expired
+	boost::optional<std::string> collectCredentials(const std::string& podName, const std::string& uid){
+		std::lock_guard<std::mutex> lock(claimsMut);
+		auto claim=claims.find(podName);
+		if(claim==claims.end() || uid.empty() || claim->second.uid!=uid)
+			return {};
+		std::string credentials=claim->second.credentials;
+		claims.erase(claim);
+		return credentials;
 	}
 	
-	void remove(const std::string& globusID){
-		std::lock_guard<std::mutex> lock(mut);
-		auto it=podMap.find(globusID);
-		if(it==podMap.end())
-			return;
-		usedPorts.erase(it->second.servicePort);
-		podMap.erase(it);
-		saveData();
+private:
+	///Credentials waiting to be collected by a claimed pod
+	struct Claim{
+		std::string uid;
+		std::string credentials;
+		std::chrono::steady_clock::time_point time;
+	};
+	
+	///The time after which uncollected credentials are discarded, leaving the 
+	///pod to find them in its annotations file
+	const static std::chrono::minutes claimLifetime;
+	
+	const kubernetes::Client& kube;
+	const Template& manifest;
+	const unsigned int size;
+	const std::string claimURL;
+	std::mutex claimsMut;
+	///Credentials waiting for claimed pods, indexed by pod name
+	std::map<std::string,Claim> claims;
+	
+	///Make a newly claimed pod's credentials available for it to collect
+	///\param podName the name of the pod
+	///\param pod the pod, as returned by the claim
+	///\param credentials the credentials, indexed by annotation name
+	void offerCredentials(const std::string& podName, const std::string& pod, 
+	                      const std::map<std::string,std::string>& credentials){
+		rapidjson::Document data;
+		data.Parse(pod);
+		if(data.HasParseError() || !data.IsObject() || !data.HasMember("metadata") 
+		   || !data["metadata"].HasMember("uid") || !data["metadata"]["uid"].IsString())
+			return; //the pod will have to wait for its annotations file
+		std::string text;
+		for(const auto& credential : credentials)
+			text+=credential.first+"=\""+credential.second+"\"\n";
+		const auto now=std::chrono::steady_clock::now();
+		std::lock_guard<std::mutex> lock(claimsMut);
+		for(auto it=claims.begin(); it!=claims.end();){
+			if(now-it->second.time>claimLifetime)
+				it=claims.erase(it);
+			else
+				++it;
+		}
+		claims[podName]=Claim{data["metadata"]["uid"].GetString(),text,now};
 	}
+};
+const std::chrono::minutes WarmPool::claimLifetime(10);
+
+///Finds the pod started for a user's new deployment, by waiting for the 
+///cluster state's watch of pods to report it rather than repeatedly listing 
+///pods. 
+class PodLocator{
+public:
+	///\param kube the client used to talk to the API server
+	///\param cluster the in-memory cluster state to consult
+	///\param timeout the number of seconds to wait for a pod to appear, or zero 
+	///               to wait indefinitely
+	PodLocator(const kubernetes::Client& kube, ClusterState& cluster, unsigned int timeout):
+	kube(kube),cluster(cluster),timeout(timeout){}
 	
-	unsigned int getPort(){
-		std::lock_guard<std::mutex> lock(mut);
-		for(unsigned int port=5000; port<10000; port++){
-			if(!usedPorts.count(port))
-				return port;
+	///Wait for a user's pod to exist
+	///\param globusID the ID of the user owning the pod
+	///\param appLabel the value of the app label on the user's pods
+	///\return the state of the first pod found which is not being deleted
+	///\throws std::runtime_error if the pod does not appear within the timeout, 
+	///        or the pods cannot be listed
+	PodState locate(const std::string& globusID, const std::string& appLabel){
+		//the subscription may outlive this call, so its state is shared
+		struct Wakeup{
+			std::mutex mut;
+			std::condition_variable cond;
+			bool changed=false;
+		};
+		auto wakeup=std::make_shared<Wakeup>();
+		auto subscription=cluster.subscribe(globusID,[wakeup]{
+			std::lock_guard<std::mutex> lock(wakeup->mut);
+			wakeup->changed=true;
+			wakeup->cond.notify_all();
+		});
+		const auto deadline=std::chrono::steady_clock::now()+std::chrono::seconds(timeout);
+		try{
+			while(true){
+				//check before waiting, since the pod may have appeared before 
+				//the subscription was made
+				auto pod=find(globusID,appLabel);
+				if(pod){
+					cluster.unsubscribe(globusID,subscription);
+					return *pod;
+				}
+				std::unique_lock<std::mutex> lock(wakeup->mut);
+				//while the cluster state is not being watched changes will not 
+				//be reported, so fall back to checking periodically
+				auto wakeTime=std::chrono::steady_clock::now()+(cluster.synced()?std::chrono::seconds(30):std::chrono::seconds(1));
+				if(timeout){
+					if(std::chrono::steady_clock::now()>=deadline)
+						throw std::runtime_error("No pod was started within "+std::to_string(timeout)+" seconds");
+					wakeTime=std::min(wakeTime,deadline);
+				}
+				wakeup->cond.wait_until(lock,wakeTime,[&]{ return wakeup->changed; });
+				wakeup->changed=false;
+			}
+		}catch(...){
+			cluster.unsubscribe(globusID,subscription);
+			throw;
 		}
-		throw std::runtime_error("port range exhausted");
 	}
 	
 private:
-	std::mutex mut;
-	std::string persistentPath;
-	std::map<std::string,UserData> podMap;
-	std::set<unsigned int> usedPorts;
-	
-	//\pre mut held
-	void saveData(){
-		const static std::string tmpName="tmp_data";
-		std::ofstream out(tmpName);
-		boost::archive::text_oarchive ar(out);
-		ar << podMap;
-		out.close();
-		rename(tmpName.c_str(),persistentPath.c_str());
-	}
-	//\pre mut held
-	void loadData(){
-		std::ifstream in(persistentPath);
-		if(!in){
-			std::cout << "Unable to read '" << persistentPath 
-			  << "'; continuing with no saved user data" << std::endl;
-			return;
+	const kubernetes::Client& kube;
+	ClusterState& cluster;
+	const unsigned int timeout;
+	
+	///\return the state of a user's pod which is not being deleted, or nothing 
+	///        if there is none
+	boost::optional<PodState> find(const std::string& globusID, const std::string& appLabel) const{
+		if(cluster.synced()){
+			for(const auto& pod : cluster.findPods(globusID)){
+				if(!pod.terminating)
+					return pod;
+			}
+			return {};
+		}
+		auto result=kube.listPods(sandboxNamespace,"app="+appLabel);
+		if(result.status!=200){
+			std::cerr << kubernetes::errorMessage(result) << std::endl;
+			throw std::runtime_error("Unable to look up kubernetes pods");
 		}
-		boost::archive::text_iarchive ar(in);
-		ar >> podMap;
-		std::cout << "Reloaded " << podMap.size() << " account records" << std::endl;
-		for(const auto& account : podMap)
-			usedPorts.insert(account.second.servicePort);
+		rapidjson::Document listing;
+		listing.Parse(result.body);
+		if(listing.HasParseError() || !listing.HasMember("items") || !listing["items"].IsArray())
+			throw std::runtime_error("Unable to parse JSON from pod listing");
+		for(const auto& pod : listing["items"].GetArray()){
+			PodState state=parsePodState(pod);
+			if(!state.terminating)
+				return state;
+		}
+		return {};
 	}
 };
 
-const static std::string namePattern="{{name}}";
-const static std::string authPattern="{{auth}}";
-const static std::string portPattern="{{external-port}}";
-const static std::string slateTokenPattern="{{slate-token}}";
-const static std::string slateEndpointPattern="{{slate-endpoint}}";
-const static std::string deploymentTemplate=R"(apiVersion: v1
-kind: Secret
-metadata:
-  name: {{name}}-slate-data
-  namespace: tutorial
-type: Opaque
-data:
-  token: {{slate-token}}
-  endpoint: {{slate-endpoint}}
----
-apiVersion: apps/v1
-kind: Deployment
-metadata:
-  name: {{name}}
-  namespace: tutorial
-  labels:
-    app: {{name}}
-spec:
-  replicas: 1
-  selector:
-    matchLabels:
-      app: {{name}}
-  template:
-    metadata:
-      labels:
-        app: {{name}}
-    spec:
-      hostname: sandbox
-      containers:
-      - name: {{name}}
-        image: slateci/container-ttyd
-        command: ["ttyd"]
-        args: ["-u","999","-g","999","--ssl","--ssl-cert","/opt/ttyd/cert1.pem","--ssl-key","/opt/ttyd/privkey1.pem","-c","{{auth}}","bash"]
-        imagePullPolicy: Always
-        ports:
-        - containerPort: 7681
-          name: ttyd
-        volumeMounts:
-        - name: server-certificate
-          mountPath: "/opt/ttyd"
-        - name: slate-client
-          mountPath: "/usr/local/bin/slate"
-        env:
-          - name: SLATE_API_ENDPOINT
-            valueFrom:
-              secretKeyRef:
-                name: {{name}}-slate-data
-                key: endpoint
-          - name: SLATE_TOKEN
-            valueFrom:
-              secretKeyRef:
-                name: {{name}}-slate-data
-                key: token
-      volumes:
-      - name: server-certificate
-        secret:
-          secretName: server-certificate
-          defaultMode: 384 # 0600
-      - name: slate-client
-        hostPath:
-          path: /opt/sandbox-spawner/slate
-          type: File
----
-kind: Service
-apiVersion: v1
-metadata:
-  name: {{name}}-service
-  namespace: tutorial
-spec:
-  selector:
-    app: {{name}}
-  type: "NodePort"
-  ports:
-  - protocol: TCP
-    port: {{external-port}} # external port
-    targetPort: 7681 # internal port where the daemon is listening
-)";
-
-//this should be done with regular expressions but gcc 4.8 is too broken
-void replaceAll(std::string& base, const std::string& target, const std::string& replacement){
-	std::size_t pos=0;
-	while((pos=base.find(target,pos))!=std::string::npos)
-		base.replace(pos,target.size(),replacement);
-}
+///Scales the deployments of sandboxes which have not been used for a while 
+///down to zero, so that idle users do not occupy the cluster, and back up 
+///again when their users return. A suspended account keeps its record, port, 
+///service and secret, but has no pod. 
+class IdleReaper{
+public:
+	///\param timeout the number of seconds without activity after which a 
+	///               sandbox is suspended, or zero to never suspend sandboxes
+	IdleReaper(DataStore& store, EndpointCache& endpoints, const kubernetes::Client& kube, 
+	           unsigned int timeout):
+	store(store),endpoints(endpoints),kube(kube),timeout(timeout),stop(false){}
+	
+	///Stops the background thread
+	~IdleReaper(){
+		{
+			std::lock_guard<std::mutex> lock(activityMut);
+			stop=true;
+		}
+		wakeup.notify_all();
+		if(thread.joinable())
+			thread.join();
+	}
+	
+	IdleReaper(const IdleReaper&)=delete;
+	IdleReaper& operator=(const IdleReaper&)=delete;
+	
+	///Start the background thread which looks for idle sandboxes, if 
+	///suspending sandboxes is enabled
+	void start(){
+		if(timeout.count())
+			thread=std::thread(&IdleReaper::run,this);
+	}
+	
+	///Record that a user's sandbox is in use. This must be done before 
+	///checking whether the account is suspended: an account which has not 
+	///been found to be idle by the time this returns will not be suspended 
+	///until it has been idle for the full timeout again. 
+	void touch(const std::string& globusID){
+		std::lock_guard<std::mutex> lock(activityMut);
+		lastActivity[globusID]=clock::now();
+	}
+	
+	///Scale a suspended sandbox's deployment back up, after any suspension of 
+	///a sandbox which is still in progress has finished
+	///\throws std::runtime_error if the deployment cannot be scaled
+	void resume(const std::string& deploymentName){
+		std::lock_guard<std::mutex> lock(scaleMut);
+		auto result=scale(deploymentName,1);
+		if(result.status!=200)
+			throw std::runtime_error("Unable to scale up deployment: "+kubernetes::errorMessage(result));
+	}
+	
+private:
+	typedef std::chrono::steady_clock clock;
+	
+	DataStore& store;
+	EndpointCache& endpoints;
+	const kubernetes::Client& kube;
+	const std::chrono::seconds timeout;
+	
+	///Guards the activity times and the decision to suspend a sandbox
+	std::mutex activityMut;
+	std::condition_variable wakeup;
+	bool stop;
+	std::map<std::string,clock::time_point> lastActivity;
+	///Held while scaling a deployment, and by a suspension from marking the 
+	///account suspended until its deployment is scaled down, so that a 
+	///sandbox which is resumed while being suspended ends up running. 
+	///Acquired before activityMut when both are needed. 
+	std::mutex scaleMut;
+	std::thread thread;
+	
+	httpRequests::Response scale(const std::string& deploymentName, unsigned int replicas){
+		rapidjson::Document patch(rapidjson::kObjectType);
+		rapidjson::Document::AllocatorType& alloc = patch.GetAllocator();
+		rapidjson::Value spec(rapidjson::kObjectType);
+		spec.AddMember("replicas", replicas, alloc);
+		patch.AddMember("spec", spec, alloc);
+		return kube.patchDeployment(sandboxNamespace,deploymentName,to_string(patch));
+	}
+	
+	///\return whether an account's sandbox may be suspended
+	///\pre activityMut held
+	bool suspendable(const std::string& globusID, const UserData& account, clock::time_point now){
+		//A sandbox claimed from the warm pool has no deployment to scale. An 
+		//account being created has no record yet, and one being resumed is 
+		//still marked as suspended. 
+		if(account.deleting || account.suspended || account.deploymentName.empty())
+			return false;
+		auto last=lastActivity.find(globusID);
+		return last!=lastActivity.end() && now-last->second>=timeout;
+	}
+	
+	void run(){
+		//check often enough that no sandbox lingers much past the timeout
+		const auto interval=std::min(std::max(timeout/10,std::chrono::seconds(1)),std::chrono::seconds(60));
+		std::unique_lock<std::mutex> lock(activityMut);
+		while(!stop){
+			wakeup.wait_for(lock,interval);
+			if(stop)
+				return;
+			lock.unlock();
+			reap();
+			lock.lock();
+		}
+	}
+	
+	///Suspend every sandbox which has been idle for too long
+	void reap(){
+		auto records=store.records();
+		std::vector<std::string> candidates;
+		{
+			std::lock_guard<std::mutex> lock(activityMut);
+			const auto now=clock::now();
+			//Accounts not seen before (e.g. since a restart) start their idle 
+			//time now, and activity for accounts which no longer exist is 
+			//forgotten. 
+			std::map<std::string,clock::time_point> current;
+			for(const auto& account : records){
+				auto last=lastActivity.find(account.first);
+				current.emplace(account.first,last!=lastActivity.end()?last->second:now);
+			}
+			lastActivity.swap(current);
+			for(const auto& account : records){
+				if(suspendable(account.first,account.second,now))
+					candidates.push_back(account.first);
+			}
+		}
+		for(const auto& globusID : candidates){
+			//Hold scaleMut from marking the account suspended until the 
+			//deployment has been scaled down, so that a resumption which sees 
+			//the mark cannot scale the deployment up before this scales it 
+			//down. 
+			std::lock_guard<std::mutex> lock(scaleMut);
+			//mark the account suspended, unless it has been used or changed in 
+			//the meantime
+			UserData account;
+			{
+				std::lock_guard<std::mutex> activityLock(activityMut);
+				const auto now=clock::now();
+				try{
+					bool marked=store.update(globusID,[&](UserData& record){
+						if(!suspendable(globusID,record,now))
+							return false;
+						account=record;
+						record.suspended=true;
+						record.podName="";
+						return true;
+					});
+					if(!marked)
+						continue;
+				}catch(std::runtime_error& err){
+					std::cerr << "Unable to record suspension of " << globusID << ": " << err.what() << std::endl;
+					continue;
+				}
+			}
+			endpoints.invalidate(globusID);
+			std::cout << "Suspending idle sandbox of " << globusID << std::endl;
+			auto result=scale(account.deploymentName,0);
+			if(result.status==200)
+				continue;
+			std::cerr << "Unable to suspend sandbox of " << globusID << ": " 
+			  << kubernetes::errorMessage(result) << std::endl;
+			//the pod is still running, so put back the record, unless the 
+			//account has been resumed or deleted meanwhile
+			try{
+				store.update(globusID,[&](UserData& record){
+					if(!record.suspended || record.deleting)
+						return false;
+					record.suspended=false;
+					record.podName=account.podName;
+					return true;
+				});
+			}catch(std::runtime_error& err){
+				std::cerr << "Unable to restore record of " << globusID << ": " << err.what() << std::endl;
+			}
+		}
+	}
+};
 
-crow::response createAccount(const Configuration& config, DataStore& store, const crow::request& req, const std::string globusID){
-	auto account=store.find(globusID);
+///Brings the account records and the sandbox objects in the cluster back into 
+///agreement, at startup and then periodically: objects belonging to no 
+///account (e.g. left by a crash part way through creating a sandbox) are 
+///deleted, freeing their node ports, and records whose pods have been 
+///replaced are updated with the current pod names. 
+///
+///An object is only deleted once it has been found to be orphaned by two 
+///passes, or is older than orphanGracePeriod. If the data store found no 
+///saved data at startup, which may mean that the data file is missing rather 
+///than that there are no users, no objects are deleted at all, unless the 
+///removeOrphansWithoutData option is set. 
+class Reconciler{
+public:
+	///\param interval the number of seconds between passes, or zero to make 
+	///                only the pass at startup
+	Reconciler(const Configuration& config, const ManifestTemplates& templates, DataStore& store, JobQueue& jobs, 
+	           const kubernetes::Client& kube, unsigned int interval):
+	config(config),templates(templates),store(store),jobs(jobs),kube(kube),interval(interval),
+	removeOrphans(store.foundSavedData() || config.removeOrphansWithoutData=="true"),stop(false){
+		if(!removeOrphans)
+			std::cerr << "No saved user data was found, so orphaned sandbox objects will not be removed "
+			  "(set removeOrphansWithoutData=true to remove them anyway)" << std::endl;
+	}
 	
-	if(!account){ //create account if it does not exist
-		std::cout << "creating account " << globusID << std::endl;
-		//make a blank object
-		account=UserData{};
-		//generate an authentication token
-		account->authToken=tokenGenerator.getToken();
-		account->servicePort=store.getPort();
-		//create the acount in SLATE
-		std::cout << "Creating SLATE account" << std::endl;
-		rapidjson::Document request(rapidjson::kObjectType);
-		rapidjson::Document::AllocatorType& alloc = request.GetAllocator();
-		request.AddMember("version", "v1alpha3", alloc);
-		rapidjson::Value metadata(rapidjson::kObjectType);
-		metadata.AddMember("name", globusID, alloc);
-		metadata.AddMember("email", "-", alloc);
-		metadata.AddMember("phone", "-", alloc);
-		metadata.AddMember("institution", "-", alloc);
-		metadata.AddMember("globusID", globusID, alloc);
-		metadata.AddMember("admin", false, alloc);
-		request.AddMember("metadata", metadata, alloc);
+	///Stops the background thread, after any pass in progress
+	~Reconciler(){
+		{
+			std::lock_guard<std::mutex> lock(mut);
+			stop=true;
+		}
+		wakeup.notify_all();
+		if(thread.joinable())
+			thread.join();
+	}
+	
+	Reconciler(const Reconciler&)=delete;
+	Reconciler& operator=(const Reconciler&)=delete;
+	
+	///Start the background thread, which makes its first pass immediately
+	void start(){
+		thread=std::thread(&Reconciler::run,this);
+	}
+	
+private:
+	///An object which belongs to a sandbox
+	struct SandboxObject{
+		kubernetes::Kind kind;
+		std::string name;
+		///The ID of the user owning the object
+		std::string owner;
+		///The server's unique ID for this incarnation of the object
+		std::string uid;
+		///When the object was created, or zero if this is not known
+		std::time_t created;
+	};
+	
+	///The number of deletions to make at the same time
+	const static std::size_t deletionBatchSize=16;
+	///The number of seconds after its creation after which an orphaned 
+	///object may be deleted by the first pass which finds it
+	const static std::time_t orphanGracePeriod=900;
+	
+	const Configuration& config;
+	const ManifestTemplates& templates;
+	DataStore& store;
+	JobQueue& jobs;
+	const kubernetes::Client& kube;
+	const std::chrono::seconds interval;
+	///Whether orphaned objects may be deleted
+	const bool removeOrphans;
+	///The UIDs of the orphaned objects found by the last pass which were not 
+	///deleted. Used only by the background thread. 
+	std::set<std::string> suspects;
+	
+	std::mutex mut;
+	std::condition_variable wakeup;
+	bool stop;
+	std::thread thread;
+	
+	void run(){
+		std::unique_lock<std::mutex> lock(mut);
+		while(!stop){
+			lock.unlock();
+			try{
+				reconcile();
+			}catch(std::exception& ex){
+				std::cerr << "Reconciliation failed: " << ex.what() << std::endl;
+			}
+			lock.lock();
+			if(!interval.count())
+				return;
+			wakeup.wait_for(lock,interval);
+		}
+	}
+	
+	///Fetch the JSON listing of all objects of one kind
+	///\throws std::runtime_error if the listing fails
+	rapidjson::Document list(kubernetes::Kind kind, const std::string& labelSelector) const{
+		auto result=kube.list(kind,sandboxNamespace,labelSelector);
+		if(result.status!=200)
+			throw std::runtime_error("Unable to list objects: "+kubernetes::errorMessage(result));
+		rapidjson::Document listing;
+		listing.Parse(result.body);
+		if(listing.HasParseError() || !listing.IsObject() || !listing.HasMember("items") 
+		   || !listing["items"].IsArray())
+			throw std::runtime_error("Unable to parse JSON from object listing");
+		return listing;
+	}
+	
+	///Interpret a timestamp of the form kubernetes uses, e.g. 
+	///"2020-06-01T12:00:00Z"
+	///\return the time, or zero if it cannot be parsed
+	static std::time_t parseTimestamp(const std::string& text){
+		std::tm time={};
+		if(std::sscanf(text.c_str(),"%d-%d-%dT%d:%d:%dZ",&time.tm_year,&time.tm_mon,&time.tm_mday,
+		               &time.tm_hour,&time.tm_min,&time.tm_sec)!=6)
+			return 0;
+		time.tm_year-=1900;
+		time.tm_mon-=1;
+		std::time_t result=timegm(&time);
+		return result==(std::time_t)-1 ? 0 : result;
+	}
+	
+	///Describe an object from its metadata
+	static SandboxObject describeObject(kubernetes::Kind kind, const std::string& name, 
+	                                    const std::string& owner, const rapidjson::Value& metadata){
+		SandboxObject object{kind,name,owner,"",0};
+		if(metadata.HasMember("uid") && metadata["uid"].IsString())
+			object.uid=metadata["uid"].GetString();
+		if(metadata.HasMember("creationTimestamp") && metadata["creationTimestamp"].IsString())
+			object.created=parseTimestamp(metadata["creationTimestamp"].GetString());
+		return object;
+	}
+	
+	///Find the sandbox objects of one kind, which are recognized by their names
+	///\param suffix what follows the app label in the names of objects of 
+	///              this kind
+	std::vector<SandboxObject> listObjects(kubernetes::Kind kind, const std::string& suffix) const{
+		std::vector<SandboxObject> objects;
+		auto listing=list(kind,"");
+		for(const auto& item : listing["items"].GetArray()){
+			if(!item.HasMember("metadata") || !item["metadata"].HasMember("name") 
+			   || !item["metadata"]["name"].IsString())
+				continue;
+			std::string name=item["metadata"]["name"].GetString();
+			if(name.size()<=suffix.size() || name.compare(name.size()-suffix.size(),suffix.size(),suffix)!=0)
+				continue;
+			std::string owner=userFromAppLabel(name.substr(0,name.size()-suffix.size()));
+			if(!owner.empty())
+				objects.push_back(describeObject(kind,name,owner,item["metadata"]));
+		}
+		return objects;
+	}
+	
+	///Find the sandbox pods, which are recognized by their app labels
+	///\param objects filled with descriptions of the pods, indexed by the ID 
+	///               of the owning user
+	///\return the pods, indexed by the ID of the owning user
+	std::map<std::string,std::vector<PodState>> listPods(std::map<std::string,std::vector<SandboxObject>>& objects) const{
+		std::map<std::string,std::vector<PodState>> pods;
+		auto listing=list(kubernetes::Kind::Pod,"app");
+		for(const auto& item : listing["items"].GetArray()){
+			const rapidjson::Value& metadata=item["metadata"];
+			if(!metadata.HasMember("labels") || !metadata["labels"].HasMember("app") 
+			   || !metadata["labels"]["app"].IsString())
+				continue;
+			std::string owner=userFromAppLabel(metadata["labels"]["app"].GetString());
+			if(owner.empty())
+				continue;
+			pods[owner].push_back(parsePodState(item));
+			objects[owner].push_back(describeObject(kubernetes::Kind::Pod,pods[owner].back().name,owner,metadata));
+		}
+		return pods;
+	}
+	
+	///\return whether objects belonging to a user are unaccounted for: the 
+	///        user has no record, and no job which might be creating one
+	bool orphaned(const std::string& owner) const{
+		return !store.find(owner) && !jobs.inProgress(owner);
+	}
+	
+	///Give a sandbox claimed from the warm pool, whose bare pod has gone, a 
+	///deployment of its own, which will start a new pod
+	///\return whether the deployment was created and recorded
+	///\throws std::runtime_error if the pod cannot be checked or the deployment 
+	///        cannot be created
+	bool redeploy(const std::string& globusID, const UserData& account){
+		//the pod may have been claimed after the listing was made
+		auto result=kube.getPod(sandboxNamespace,account.podName);
+		if(result.status==200){
+			rapidjson::Document pod;
+			pod.Parse(result.body);
+			if(pod.HasParseError())
+				throw std::runtime_error("Unable to parse JSON from kubernetes");
+			PodState state=parsePodState(pod);
+			if(!state.terminating && !state.finished)
+				return false;
+		}
+		else if(result.status!=404)
+			throw std::runtime_error("Unable to check pod: "+kubernetes::errorMessage(result));
 		
-		std::string url=config.slateEndpoint+"/v1alpha3/users?token="+config.slateAdminToken;
-		auto response=httpRequests::httpPost(url,to_string(request));
-		if(response.status!=200){
-			std::cerr << "Error: " << response.body << std::endl;
-			return crow::response(500,generateError("Failed to create SLATE account"));
+		const std::string name="ttyd-"+globusID;
+		createObject(kube,templates.deployment.render(accountManifestValues(config,globusID,account)));
+		//Should the account have been deleted meanwhile, the deployment is an 
+		//orphan which a later pass will remove. The pod name is left for 
+		//the deployment's pod to replace when it is first looked up. 
+		bool recorded=store.update(globusID,[&](UserData& record){
+			if(record.deleting || !record.deploymentName.empty() || record.podName!=account.podName)
+				return false;
+			record.deploymentName=name;
+			return true;
+		});
+		if(!recorded)
+			return false;
+		std::cout << "Pod " << account.podName << " of " << globusID << " is gone; created deployment " 
+		  << name << " to replace it" << std::endl;
+		//an evicted pod remains until it is deleted, and the deployment will 
+		//not do so since it does not own it
+		result=kube.remove(kubernetes::Kind::Pod,sandboxNamespace,account.podName);
+		if(result.status!=200 && result.status!=202 && result.status!=404)
+			std::cerr << "Failed to delete pod " << account.podName << ": " 
+			  << kubernetes::errorMessage(result) << std::endl;
+		return true;
+	}
+	
+	void reconcile(){
+		const auto started=std::chrono::steady_clock::now();
+		//list everything at once
+		auto deploymentListing=std::async(std::launch::async,[this]{ return listObjects(kubernetes::Kind::Deployment,""); });
+		auto serviceListing=std::async(std::launch::async,[this]{ return listObjects(kubernetes::Kind::Service,"-service"); });
+		auto secretListing=std::async(std::launch::async,[this]{ return listObjects(kubernetes::Kind::Secret,"-slate-data"); });
+		std::map<std::string,std::vector<SandboxObject>> podObjects;
+		auto pods=listPods(podObjects);
+		auto deployments=deploymentListing.get();
+		auto services=serviceListing.get();
+		auto secrets=secretListing.get();
+		auto records=store.records();
+		
+		//objects whose owners have no record, other than those which a job 
+		//is still creating, or which a deletion is still cleaning up
+		std::vector<SandboxObject> orphans;
+		std::set<std::string> deploymentOwners;
+		for(const auto* objects : {&deployments,&services,&secrets}){
+			for(const auto& object : *objects){
+				if(object.kind==kubernetes::Kind::Deployment)
+					deploymentOwners.insert(object.owner);
+				if(!records.count(object.owner) && orphaned(object.owner))
+					orphans.push_back(object);
+			}
+		}
+		//pods claimed from the warm pool have no deployment to delete them
+		for(const auto& owner : podObjects){
+			if(deploymentOwners.count(owner.first) || records.count(owner.first) || !orphaned(owner.first))
+				continue;
+			for(const auto& pod : owner.second)
+				orphans.push_back(pod);
 		}
 		
-		rapidjson::Document slateData;
-		try{
-			slateData.Parse(response.body);
-		}catch(std::runtime_error& err){
-			return crow::response(500,generateError("Unable to parse JSON from SLATE API"));
-		}
-		account->slateID=slateData["metadata"]["id"].GetString();
-		account->slateToken=slateData["metadata"]["access_token"].GetString();
-		std::cout << "SLATE ID is " << account->slateID << std::endl;
-		//deploy the pod and service in kubernetes
-		std::string name="ttyd-"+globusID;
-		std::string deployment=deploymentTemplate;
-		replaceAll(deployment,namePattern,name);
-		replaceAll(deployment,authPattern,account->authToken);
-		replaceAll(deployment,portPattern,std::to_string(account->servicePort));
-		replaceAll(deployment,slateTokenPattern,base64_encode(account->slateToken.c_str(),account->slateToken.size()));
-		replaceAll(deployment,slateEndpointPattern,base64_encode(config.slateEndpoint.c_str(),config.slateEndpoint.size()));
+		//records whose pods have been replaced
+		std::size_t repaired=0;
+		for(const auto& account : records){
+			const UserData& data=account.second;
+			if(data.deleting || data.suspended || data.podName.empty() || jobs.inProgress(account.first))
+				continue;
+			auto owned=pods.find(account.first);
+			if(owned==pods.end())
+				continue; //nothing to switch to
+			std::string replacement;
+			bool current=false;
+			for(const auto& pod : owned->second){
+				if(pod.name==data.podName && !pod.terminating)
+					current=true;
+				else if(!pod.terminating && replacement.empty())
+					replacement=pod.name;
+			}
+			if(current || replacement.empty())
+				continue;
+			const std::string stale=data.podName;
+			bool changed=store.update(account.first,[&](UserData& record){
+				//leave the record alone if anything else has changed it
+				if(record.deleting || record.suspended || record.podName!=stale)
+					return false;
+				record.podName=replacement;
+				return true;
+			});
+			if(changed){
+				std::cout << "Pod of " << account.first << " is now " << replacement << std::endl;
+				repaired++;
+			}
+		}
 		
-		std::cout << "Deploying kubernetes objects" << std::endl;
-		{
-			std::ofstream tmpfile(globusID);
-			tmpfile << deployment;
-		}
-		auto applyResult=runCommand("kubectl",{"apply","-f",globusID});
-		remove(globusID.c_str());
-		if(applyResult.status!=0){
-			std::cerr << applyResult.error << std::endl;
-			return crow::response(500,generateError("Unable to deploy kubernetes pod"));
-		}
-		account->deploymentName=name;
-		account->serviceName=name+"-service";
-		account->secretName=name+"-slate-data";
-		//figure out the name of the pod which was started
-		std::cout << "Locating new pod" << std::endl;
-		while(account->podName.empty()){
-			auto podResult=runCommand("kubectl",{"get","pods","-l","app="+name,"-n=tutorial","-o=json"});
-			if(podResult.status!=0){
-				std::cerr << podResult.error << std::endl;
-				return crow::response(500,generateError("Unable to look up kubernetes pods"));
+		//Sandboxes claimed from the warm pool have bare pods, which nothing 
+		//replaces if they are evicted or their nodes are drained. 
+		std::size_t redeployed=0;
+		for(const auto& account : records){
+			const UserData& data=account.second;
+			if(!data.deploymentName.empty() || data.podName.empty() || data.deleting || data.suspended 
+			   || jobs.inProgress(account.first))
+				continue;
+			bool alive=false;
+			auto owned=pods.find(account.first);
+			if(owned!=pods.end()){
+				for(const auto& pod : owned->second)
+					alive=alive || (!pod.terminating && !pod.finished);
 			}
-			rapidjson::Document podListing;
+			if(alive)
+				continue;
 			try{
-				podListing.Parse(podResult.output);
+				if(redeploy(account.first,data))
+					redeployed++;
 			}catch(std::runtime_error& err){
-				return crow::response(500,generateError("Unable to parse JSON from pod listing"));
+				std::cerr << "Unable to replace the pod of " << account.first << ": " << err.what() << std::endl;
 			}
-			if(!podListing.HasMember("items") || !podListing["items"].IsArray() || !podListing["items"].Size())
-				std::cout << "Found no pods" << std::endl;
-			else
-				for(const auto& pod : podListing["items"].GetArray()){
-					if(!pod["metadata"].HasMember("deletionTimestamp"))
-						account->podName=pod["metadata"]["name"].GetString();
+		}
+		
+		//Only delete orphans which were also found by the last pass, or which 
+		//are old enough that they cannot belong to a sandbox still being set 
+		//up. The rest are remembered for the next pass. 
+		std::vector<const SandboxObject*> doomed;
+		std::set<std::string> newSuspects;
+		const std::time_t now=std::time(nullptr);
+		for(const auto& orphan : orphans){
+			bool old=orphan.created && now-orphan.created>=orphanGracePeriod;
+			if(removeOrphans && !orphan.uid.empty() && (suspects.count(orphan.uid) || old))
+				doomed.push_back(&orphan);
+			else if(!orphan.uid.empty())
+				newSuspects.insert(orphan.uid);
+		}
+		suspects.swap(newSuspects);
+		
+		//delete the orphans in batches
+		std::size_t removed=0;
+		for(std::size_t i=0; i<doomed.size(); i+=deletionBatchSize){
+			std::vector<std::pair<const SandboxObject*,std::future<httpRequests::Response>>> deletions;
+			for(std::size_t j=i; j<doomed.size() && j<i+deletionBatchSize; j++){
+				const SandboxObject& orphan=*doomed[j];
+				//the owner may have been recorded since the listing
+				if(!orphaned(orphan.owner))
+					continue;
+				//the UID precondition protects an object of the same name 
+				//created since the listing
+				deletions.emplace_back(&orphan,std::async(std::launch::async,[this,&orphan]{
+					return kube.remove(orphan.kind,sandboxNamespace,orphan.name,"Background",orphan.uid);
+				}));
+			}
+			for(auto& deletion : deletions){
+				auto result=deletion.second.get();
+				if(result.status==200 || result.status==202){
+					std::cout << "Removed orphaned object " << deletion.first->name << std::endl;
+					removed++;
 				}
-			if(account->podName.empty()) //wait a short time before retrying
-				std::this_thread::sleep_for(std::chrono::milliseconds(100));
+				else if(result.status!=404 && result.status!=409)
+					std::cerr << "Unable to remove orphaned object " << deletion.first->name << ": " 
+					  << kubernetes::errorMessage(result) << std::endl;
+			}
 		}
-		store.record(globusID,*account);
+		
+		std::cout << "Reconciled " << records.size() << " accounts with the cluster in " 
+		  << std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now()-started).count()
+		  << " seconds: removed " << removed << " orphaned objects (" << suspects.size() 
+		  << " more not yet removed), repaired " << repaired 
+		  << " pod names, and replaced " << redeployed << " lost warm pool pods" << std::endl;
 	}
+};
+
+///The stages of creating a sandbox, in order
+const static std::vector<std::string> provisioningStages={"slate-user","secret","deployment","service","pod-discovery"};
+
+///Carry out the stages of creating a sandbox for a user, and record the 
+///account once it is complete. If any stage fails, everything created by the 
+///earlier stages is removed again, so that a later attempt can start afresh. 
+///\param account the user's details, with the authentication token and port 
+///               already filled in
+///\param port the reservation of the port in \p account, which is kept only if 
+///            the sandbox is created
+///\throws std::runtime_error if any stage fails
+void provisionAccount(Job& job, const Configuration& config, const ManifestTemplates& templates, DataStore& store, WarmPool& pool, 
+                      PodLocator& locator, EndpointCache& endpoints, const kubernetes::Client& kube, const std::string& globusID, UserData account, 
+                      std::shared_ptr<PortReservation> port){
+	auto makeURL=[&](std::string path){
+		return config.slateEndpoint+"/v1alpha3/"+path+"?token="+config.slateAdminToken;
+	};
+	std::string name="ttyd-"+globusID;
+	//the values of the manifest placeholders, filled in once the SLATE token 
+	//is known
+	std::map<std::string,std::string> manifestValues;
+	//A request which found no account just before another request's job 
+	//recorded one will have queued a second job, which must not create a 
+	//second sandbox. 
+	if(store.find(globusID)){
+		for(const auto& stage : provisioningStages)
+			job.skipStage(stage,"account already exists");
+		return;
+	}
+	//the parts of the sandbox's endpoint learned while creating it
+	Endpoint endpoint{"","",0};
+	//what has been created so far, so that it can be cleaned up on failure
+	bool createdSlateUser=false;
+	std::vector<std::pair<kubernetes::Kind,std::string>> created;
 	
+	try{
+		job.runStage("slate-user",[&]{
+			//create the acount in SLATE
+			std::cout << "Creating SLATE account" << std::endl;
+			rapidjson::Document request(rapidjson::kObjectType);
+			rapidjson::Document::AllocatorType& alloc = request.GetAllocator();
+			request.AddMember("version", "v1alpha3", alloc);
+			rapidjson::Value metadata(rapidjson::kObjectType);
+			metadata.AddMember("name", globusID, alloc);
+			metadata.AddMember("email", "-", alloc);
+			metadata.AddMember("phone", "-", alloc);
+			metadata.AddMember("institution", "-", alloc);
+			metadata.AddMember("globusID", globusID, alloc);
+			metadata.AddMember("admin", false, alloc);
+			request.AddMember("metadata", metadata, alloc);
+			
+			auto response=httpRequests::httpPost(makeURL("users"),to_string(request));
+			if(response.status!=200){
+				std::cerr << "Error: " << response.body << std::endl;
+				throw std::runtime_error("Failed to create SLATE account");
+			}
+			
+			rapidjson::Document slateData;
+			slateData.Parse(response.body);
+			if(slateData.HasParseError())
+				throw std::runtime_error("Unable to parse JSON from SLATE API");
+			account.slateID=slateData["metadata"]["id"].GetString();
+			account.slateToken=slateData["metadata"]["access_token"].GetString();
+			createdSlateUser=true;
+			std::cout << "SLATE ID is " << account.slateID << std::endl;
+			manifestValues=accountManifestValues(config,globusID,account);
+		});
+		
+		//The secret, deployment and service do not depend on one another, so 
+		//they are created concurrently. All three are waited for even if one 
+		//fails, so that the cleanup below sees everything which was created. 
+		std::mutex createdMutex;
+		auto track=[&](kubernetes::Kind kind, const std::string& objectName){
+			std::lock_guard<std::mutex> lock(createdMutex);
+			created.emplace_back(kind,objectName);
+		};
+		std::vector<std::future<void>> objectStages;
+		objectStages.push_back(std::async(std::launch::async,[&]{
+			job.runStage("secret",[&]{
+				createObject(kube,templates.secret.render(manifestValues));
+				account.secretName=name+"-slate-data";
+				track(kubernetes::Kind::Secret,account.secretName);
+			});
+		}));
+		objectStages.push_back(std::async(std::launch::async,[&]{
+			job.runStage("deployment",[&]{
+				auto claimed=pool.claim(name,account,config.slateEndpoint);
+				if(claimed){
+					//the pod is not owned by any deployment
+					std::cout << "Claimed pool pod " << *claimed << std::endl;
+					job.describeStage("deployment","claimed pod "+*claimed+" from the warm pool");
+					account.podName=*claimed;
+					track(kubernetes::Kind::Pod,account.podName);
+					return;
+				}
+				std::cout << "Deploying kubernetes objects" << std::endl;
+				createObject(kube,templates.deployment.render(manifestValues));
+				account.deploymentName=name;
+				track(kubernetes::Kind::Deployment,account.deploymentName);
+			});
+		}));
+		objectStages.push_back(std::async(std::launch::async,[&]{
+			job.runStage("service",[&]{
+				auto result=createObject(kube,templates.service.render(manifestValues));
+				account.serviceName=name+"-service";
+				track(kubernetes::Kind::Service,account.serviceName);
+				rapidjson::Document service;
+				service.Parse(result.body);
+				try{
+					if(!service.HasParseError())
+						endpoint.nodePort=parseNodePort(service);
+				}catch(std::runtime_error& err){
+					//the port will be looked up when it is first needed
+				}
+			});
+		}));
+		std::exception_ptr objectFailure;
+		for(auto& stage : objectStages){
+			try{
+				stage.get();
+			}catch(...){
+				if(!objectFailure)
+					objectFailure=std::current_exception();
+			}
+		}
+		if(objectFailure)
+			std::rethrow_exception(objectFailure);
+		
+		if(!account.podName.empty())
+			job.skipStage("pod-discovery","pod claimed from the warm pool");
+		else job.runStage("pod-discovery",[&]{
+			//figure out the name of the pod which was started
+			std::cout << "Locating new pod" << std::endl;
+			PodState pod=locator.locate(globusID,name);
+			account.podName=pod.name;
+			endpoint.hostIP=pod.hostIP;
+		});
+		
+		store.record(globusID,account);
+		port->keep();
+		endpoint.podName=account.podName;
+		if(endpoint.nodePort && !endpoint.hostIP.empty())
+			endpoints.store(globusID,endpoint);
+	}catch(std::exception& ex){
+		std::cerr << "Provisioning failed for " << globusID << "; cleaning up" << std::endl;
+		for(auto it=created.rbegin(); it!=created.rend(); ++it){
+			httpRequests::Response result;
+			try{
+				result=kube.remove(it->first,sandboxNamespace,it->second);
+			}catch(std::runtime_error& err){
+				result=httpRequests::Response{0,err.what()};
+			}
+			if(result.status!=200 && result.status!=202 && result.status!=404)
+				std::cerr << "Failed to remove " << it->second << " while cleaning up for " << globusID 
+				  << ": " << kubernetes::errorMessage(result) << std::endl;
+		}
+		if(createdSlateUser){
+			httpRequests::Response result;
+			try{
+				result=httpRequests::httpDelete(makeURL("users/"+account.slateID));
+			}catch(std::runtime_error& err){
+				result=httpRequests::Response{0,err.what()};
+			}
+			if(result.status!=200 && result.status!=404)
+				std::cerr << "Failed to remove SLATE user " << account.slateID << " while cleaning up for " 
+				  << globusID << ": " << result.body << std::endl;
+		}
+		throw;
+	}
+}
+
+///Look up an account which is in use
+///\return the account's record, or nothing if there is none or the account 
+///        is being deleted
+boost::optional<UserData> findAccount(DataStore& store, const std::string& globusID){
+	auto account=store.find(globusID);
+	if(account && account->deleting)
+		return {};
+	return account;
+}
+
+///The stages of resuming a suspended sandbox, in order
+const static std::vector<std::string> resumptionStages={"scale-up","pod-discovery"};
+
+///Scale a suspended sandbox back up and record its new pod
+///\throws std::runtime_error if either stage fails, in which case the account 
+///        remains suspended
+void resumeAccount(Job& job, DataStore& store, IdleReaper& reaper, PodLocator& locator, const std::string& globusID){
+	auto account=store.find(globusID);
+	if(!account || account->deleting || !account->suspended){
+		for(const auto& stage : resumptionStages)
+			job.skipStage(stage,"account is not suspended");
+		return;
+	}
+	std::cout << "Resuming sandbox of " << globusID << std::endl;
+	job.runStage("scale-up",[&]{
+		reaper.resume(account->deploymentName);
+	});
+	std::string podName;
+	job.runStage("pod-discovery",[&]{
+		podName=locator.locate(globusID,account->deploymentName).name;
+	});
+	//the account may have been deleted while this job ran
+	store.update(globusID,[&](UserData& record){
+		if(!record.suspended || record.deleting)
+			return false;
+		record.podName=podName;
+		record.suspended=false;
+		return true;
+	});
+}
+
+crow::response createAccount(const Configuration& config, const ManifestTemplates& templates, DataStore& store, PortAllocator& ports, JobQueue& jobs, WarmPool& pool, PodLocator& locator, EndpointCache& endpoints, IdleReaper& reaper, const kubernetes::Client& kube, const crow::request&, const std::string globusID){
 	rapidjson::Document response(rapidjson::kObjectType);
 	rapidjson::Document::AllocatorType& alloc = response.GetAllocator();
-	response.AddMember("auth", account->authToken, alloc);
-	return crow::response(to_string(response));
+	
+	reaper.touch(globusID);
+	auto account=store.find(globusID);
+	if(account && account->deleting)
+		return crow::response(409,generateError("Account is being deleted"));
+	if(account && account->suspended){
+		//bring the sandbox back in the background, sharing the job of any 
+		//other request doing the same
+		auto job=jobs.submit(globusID,resumptionStages,
+		  [=,&store,&reaper,&locator](Job& job){ resumeAccount(job,store,reaper,locator,globusID); },
+		  account->authToken);
+		response.AddMember("auth", account->authToken, alloc);
+		response.AddMember("job", job->id(), alloc);
+		response.AddMember("status", "/account/"+globusID+"/status", alloc);
+		return crow::response(202,to_string(response));
+	}
+	if(account){
+		response.AddMember("auth", account->authToken, alloc);
+		return crow::response(to_string(response));
+	}
+	
+	//create account if it does not exist
+	//make a blank object
+	UserData newAccount{};
+	//generate an authentication token
+	newAccount.authToken=tokenGenerator.getToken();
+	//the port is returned to the pool if provisioning fails
+	std::shared_ptr<PortReservation> port;
+	try{
+		port=std::make_shared<PortReservation>(ports);
+	}catch(std::runtime_error& err){
+		return crow::response(503,generateError("No ports are available for new accounts"));
+	}
+	newAccount.servicePort=port->port();
+	
+	//the rest happens in the background, unless another request is already 
+	//creating the same account, in which case this request shares its job
+	bool joined=false;
+	auto job=jobs.submit(globusID,provisioningStages,
+	  [=,&config,&templates,&store,&pool,&locator,&endpoints,&kube](Job& job){ provisionAccount(job,config,templates,store,pool,locator,endpoints,kube,globusID,newAccount,port); },
+	  newAccount.authToken,&joined);
+	if(joined)
+		std::cout << "joining job " << job->id() << " creating account " << globusID << std::endl;
+	else
+		std::cout << "creating account " << globusID << std::endl;
+	
+	//the auth token is the one which the job will record
+	response.AddMember("auth", job->detail(), alloc);
+	response.AddMember("job", job->id(), alloc);
+	response.AddMember("status", "/account/"+globusID+"/status", alloc);
+	return crow::response(202,to_string(response));
 }
 
-crow::response podReady(DataStore& store, const crow::request& req, const std::string globusID){
-	std::cout << "checking whether pod is ready for " << globusID << std::endl;
-	auto pod=store.find(globusID);
-	if(!pod)
+///Report the progress of creating a user's sandbox
+crow::response accountStatus(DataStore& store, JobQueue& jobs, const crow::request&, const std::string globusID){
+	auto account=store.find(globusID);
+	if(account && account->deleting){
+		rapidjson::Document response(rapidjson::kObjectType);
+		rapidjson::Document::AllocatorType& alloc = response.GetAllocator();
+		response.AddMember("state", "deleting", alloc);
+		response.AddMember("stages", rapidjson::Value(rapidjson::kArrayType), alloc);
+		return crow::response(to_string(response));
+	}
+	auto job=jobs.find(globusID);
+	if(job)
+		return crow::response(job->statusJSON());
+	//the account may have been created too long ago for the job to be remembered
+	if(!account)
 		return crow::response(404,generateError("User not found"));
-	auto result=runCommand("kubectl",{"get","pod",pod->podName,"-n=tutorial","-o=json"});
-	if(result.status!=0)
-		return crow::response(500,generateError("kubectl get pod failed: "+result.error));
-	rapidjson::Document data;
-	try{
-		data.Parse(result.output);
-	}catch(std::runtime_error& err){
-		return crow::response(500,generateError("Unable to parse JSON from kubectl"));
+	rapidjson::Document response(rapidjson::kObjectType);
+	rapidjson::Document::AllocatorType& alloc = response.GetAllocator();
+	response.AddMember("state", "succeeded", alloc);
+	response.AddMember("stages", rapidjson::Value(rapidjson::kArrayType), alloc);
+	return crow::response(to_string(response));
+}
+
+///Find the current state of a user's pod, from memory if possible, otherwise 
+///from the API server. The recorded pod may have been replaced by its 
+///deployment (after an eviction, say), in which case the user's current pod is 
+///found by its app label instead, and recorded for next time. 
+///\param account the user's record, whose pod name is updated if the pod has 
+///               been replaced
+///\throws std::runtime_error if the user has no pod
+PodState resolvePod(DataStore& store, const kubernetes::Client& kube, const ClusterState& cluster, 
+                    const std::string& globusID, UserData& account){
+	boost::optional<PodState> recorded, replacement;
+	if(cluster.synced()){
+		recorded=cluster.findPod(globusID,account.podName);
+		if(!recorded || recorded->terminating){
+			for(const auto& pod : cluster.findPods(globusID)){
+				if(!pod.terminating && pod.name!=account.podName){
+					replacement=pod;
+					break;
+				}
+			}
+		}
+		//the pod may be too new to have been seen yet, so check with the API
 	}
-	if(data.IsNull() || !data.HasMember("status") || !data["status"].IsObject()
-	   || !data["status"].HasMember("conditions") || !data["status"]["conditions"].IsArray())
-		return crow::response(500,generateError("Unable to parse JSON from kubectl"));
-	bool ready=false;
-	for(const auto& condition : data["status"]["conditions"].GetArray()){
-		if(condition["type"].GetString()==std::string("Ready")){
-			//for some reason this is a string?
-			std::string readyString=condition["status"].GetString();
-			ready=(readyString=="True");
-			break;
+	if(!recorded && !replacement){
+		auto result=kube.getPod(sandboxNamespace,account.podName);
+		if(result.status==200){
+			rapidjson::Document data;
+			data.Parse(result.body);
+			if(data.HasParseError())
+				throw std::runtime_error("Unable to parse JSON from kubernetes");
+			recorded=parsePodState(data);
+		}
+		else if(result.status==404){
+			result=kube.listPods(sandboxNamespace,"app=ttyd-"+globusID);
+			if(result.status!=200)
+				throw std::runtime_error("Failed to list pods: "+kubernetes::errorMessage(result));
+			rapidjson::Document listing;
+			listing.Parse(result.body);
+			if(listing.HasParseError() || !listing.HasMember("items") || !listing["items"].IsArray())
+				throw std::runtime_error("Unable to parse JSON from pod listing");
+			for(const auto& item : listing["items"].GetArray()){
+				PodState pod=parsePodState(item);
+				if(!pod.terminating){
+					replacement=pod;
+					break;
+				}
+			}
 		}
+		else
+			throw std::runtime_error("Failed to get pod: "+kubernetes::errorMessage(result));
+	}
+	if(!replacement){
+		if(!recorded)
+			throw std::runtime_error("Sandbox has no pod");
+		return *recorded;
 	}
 	
+	const std::string stale=account.podName;
+	store.update(globusID,[&](UserData& record){
+		//leave the record alone if anything else has changed it
+		if(record.deleting || record.suspended || record.podName!=stale)
+			return false;
+		record.podName=replacement->name;
+		return true;
+	});
+	std::cout << "Pod of " << globusID << " was replaced by " << replacement->name << std::endl;
+	account.podName=replacement->name;
+	return *replacement;
+}
+
+///Find the node port of a user's service, from memory if possible, otherwise 
+///from the API server
+///\throws std::runtime_error if the service cannot be found
+unsigned int lookupNodePort(const kubernetes::Client& kube, const ClusterState& cluster, 
+                            const std::string& globusID, const std::string& serviceName){
+	if(cluster.synced()){
+		auto port=cluster.findNodePort(globusID);
+		if(port)
+			return *port;
+	}
+	auto result=kube.getService(sandboxNamespace,serviceName);
+	if(result.status!=200)
+		throw std::runtime_error("Failed to get service: "+kubernetes::errorMessage(result));
+	rapidjson::Document data;
+	data.Parse(result.body);
+	if(data.HasParseError())
+		throw std::runtime_error("Unable to parse JSON from kubernetes");
+	return parseNodePort(data);
+}
+
+std::string readinessJSON(bool ready){
 	rapidjson::Document response(rapidjson::kObjectType);
 	rapidjson::Document::AllocatorType& alloc = response.GetAllocator();
 	response.AddMember("ready", rapidjson::Value(ready), alloc);
-	return crow::response(to_string(response));
+	return to_string(response);
 }
 
-crow::response serviceDetails(const Configuration& config, DataStore& store, const crow::request& req, const std::string globusID){
-	std::cout << "getting service endpoint for " << globusID << std::endl;
-	auto account=store.find(globusID);
-	if(!account)
+///Check from memory whether a user's pod is ready
+///\param podName the name of the pod, or the empty string if it is not yet 
+///               known, in which case any of the user's pods will do
+bool podIsReady(const ClusterState& cluster, const std::string& globusID, const std::string& podName){
+	if(!podName.empty()){
+		auto pod=cluster.findPod(globusID,podName);
+		return pod && pod->ready;
+	}
+	for(const auto& pod : cluster.findPods(globusID)){
+		if(pod.ready && !pod.terminating)
+			return true;
+	}
+	return false;
+}
+
+///Find the name of the pod a readiness watch should follow
+///\return the name of the user's current pod, or the empty string if it cannot 
+///        be determined, in which case any of the user's pods should be followed
+std::string currentPodName(DataStore& store, const kubernetes::Client& kube, const ClusterState& cluster, 
+                           const std::string& globusID, boost::optional<UserData> account){
+	if(!account || account->podName.empty())
+		return "";
+	try{
+		return resolvePod(store,kube,cluster,globusID,*account).name;
+	}catch(std::runtime_error& err){
+		return "";
+	}
+}
+
+crow::response podReady(DataStore& store, JobQueue& jobs, IdleReaper& reaper, const kubernetes::Client& kube, const ClusterState& cluster, const crow::request&, const std::string globusID){
+	std::cout << "checking whether pod is ready for " << globusID << std::endl;
+	reaper.touch(globusID);
+	auto pod=findAccount(store,globusID);
+	if(!pod){
+		//a sandbox which is still being created is simply not ready yet
+		if(jobs.inProgress(globusID))
+			return crow::response(readinessJSON(false));
 		return crow::response(404,generateError("User not found"));
-	auto result=runCommand("kubectl",{"get","service",account->serviceName,"-n=tutorial","-o=json"});
-	if(result.status!=0)
-		return crow::response(500,generateError("kubectl get service failed: "+result.error));
-	rapidjson::Document data;
+	}
+	//nor is one which is suspended, or which is being resumed
+	if(pod->podName.empty())
+		return crow::response(readinessJSON(false));
+	bool ready=false;
 	try{
-		data.Parse(result.output);
+		ready=resolvePod(store,kube,cluster,globusID,*pod).ready;
 	}catch(std::runtime_error& err){
-		return crow::response(500,generateError("Unable to parse JSON from kubectl"));
+		return crow::response(500,generateError(err.what()));
 	}
+	return crow::response(readinessJSON(ready));
+}
+
+///The longest time for which a readiness request may wait
+const static unsigned int maxReadinessWait=120;
+
+///A readiness request which has been parked until the pod becomes ready or 
+///the wait times out. All of its work, and in particular every use of the 
+///response, happens on the io_service of the connection which made the 
+///request, so it needs no locking of its own. Crow keeps a connection alive 
+///until its response is ended, so the response may be used until then, but 
+///not afterwards. The waiter is owned only by its pending handlers, so it 
+///goes away with the io_service if the server stops first. 
+struct ReadinessWaiter : public std::enable_shared_from_this<ReadinessWaiter>{
+	ReadinessWaiter(crow::response& res, boost::asio::io_service& io, ClusterState& cluster, 
+	                const std::string& globusID, const std::string& podName):
+	res(res),io(io),cluster(cluster),globusID(globusID),podName(podName),
+	timer(io),subscription(0),subscribed(false),done(false){}
 	
-	if(data.IsNull() || !data.HasMember("spec") || !data["spec"].IsObject()
-	   || !data["spec"].HasMember("ports") || !data["spec"]["ports"].IsArray())
-		return crow::response(500,generateError("Unable to parse JSON from kubectl"));
-	std::string port=std::to_string(data["spec"]["ports"][0]["nodePort"].GetInt());
+	~ReadinessWaiter(){
+		if(subscribed)
+			cluster.unsubscribe(globusID,subscription);
+	}
 	
-	result=runCommand("kubectl",{"get","pod",account->podName,"-n=tutorial","-o=json"});
-	if(result.status!=0)
-		return crow::response(500,generateError("kubectl get pod failed: "+result.error));
-	try{
-		data.Parse(result.output);
-	}catch(std::runtime_error& err){
-		return crow::response(500,generateError("Unable to parse JSON from kubectl"));
+	///Begin waiting
+	///\param seconds the maximum time to wait
+	void start(unsigned int seconds){
+		std::weak_ptr<ReadinessWaiter> weakSelf=shared_from_this();
+		//changes are reported on a ClusterState thread, so hand them over 
+		//to the connection's thread
+		subscription=cluster.subscribe(globusID,[weakSelf]{
+			auto self=weakSelf.lock();
+			if(!self)
+				return;
+			self->io.post([weakSelf]{
+				if(auto self=weakSelf.lock())
+					self->check();
+			});
+		});
+		subscribed=true;
+		auto self=shared_from_this();
+		timer.expires_from_now(boost::posix_time::seconds(seconds));
+		timer.async_wait([self](const boost::system::error_code& err){
+			if(!err)
+				self->finish(false);
+		});
+		//the pod may have become ready before we subscribed
+		io.post([self]{ self->check(); });
 	}
 	
-	if(data.IsNull() || !data.HasMember("status") || !data["status"].IsObject()
-	   || !data["status"].HasMember("hostIP") || !data["status"]["hostIP"].IsString())
-		return crow::response(500,generateError("Unable to parse JSON from kubectl"));
-	std::string externalIP=data["status"]["hostIP"].GetString();
+private:
+	crow::response& res;
+	boost::asio::io_service& io;
+	ClusterState& cluster;
+	const std::string globusID;
+	const std::string podName;
+	boost::asio::deadline_timer timer;
+	std::size_t subscription;
+	bool subscribed;
+	///Whether the response has been ended, after which it must not be touched
+	bool done;
 	
-	rapidjson::Document response(rapidjson::kObjectType);
-	rapidjson::Document::AllocatorType& alloc = response.GetAllocator();
-	//!!!: This will only work if config.dnsName maps to externalIP
-	response.AddMember("endpoint", config.dnsName+":"+port, alloc);
-	return crow::response(to_string(response));
+	void check(){
+		if(done)
+			return;
+		if(podIsReady(cluster,globusID,podName))
+			finish(true);
+	}
+	
+	void finish(bool ready){
+		if(done)
+			return;
+		done=true;
+		timer.cancel();
+		cluster.unsubscribe(globusID,subscription);
+		subscribed=false;
+		if(!res.is_alive()){
+			std::cout << "client stopped waiting for pod readiness for " << globusID << std::endl;
+			return;
+		}
+		res=crow::response(readinessJSON(ready));
+		res.end();
+	}
+};
+
+///Check whether a pod is ready, and if it is not and the request has a 'wait' 
+///parameter, hold the request open until the pod becomes ready or the 
+///requested number of seconds (optionally suffixed with 's') elapses. 
+void podReadyWait(DataStore& store, JobQueue& jobs, IdleReaper& reaper, const kubernetes::Client& kube, ClusterState& cluster, const crow::request& req, crow::response& res, const std::string globusID){
+	const char* waitParam=req.url_params.get("wait");
+	unsigned long wait=0;
+	if(waitParam){
+		char* end;
+		wait=strtoul(waitParam,&end,10);
+		if(end==waitParam || (*end!='\0' && std::string(end)!="s")){
+			res=crow::response(400,generateError("Unable to parse wait time"));
+			res.end();
+			return;
+		}
+		wait=std::min(wait,(unsigned long)maxReadinessWait);
+	}
+	//without a live picture of the cluster there will be nothing to wake us, 
+	//so just answer immediately
+	if(!wait || !cluster.synced()){
+		res=podReady(store,jobs,reaper,kube,cluster,req,globusID);
+		res.end();
+		return;
+	}
+	
+	std::cout << "waiting up to " << wait << " seconds for pod to be ready for " << globusID << std::endl;
+	reaper.touch(globusID);
+	auto pod=findAccount(store,globusID);
+	//while the sandbox is being created its pod's name is not yet known
+	if(!pod && !jobs.inProgress(globusID)){
+		res=crow::response(404,generateError("User not found"));
+		res.end();
+		return;
+	}
+	std::make_shared<ReadinessWaiter>(res,*req.io_service,cluster,globusID,currentPodName(store,kube,cluster,globusID,pod))->start(wait);
 }
 
-crow::response deleteAccount(const Configuration& config, DataStore& store, const crow::request& req, const std::string globusID){
-	std::cout << "deleting account " << globusID << std::endl;
-	auto account=store.find(globusID);
+///The state of a websocket connection over which readiness changes are sent
+struct ReadinessStream{
+	std::mutex mut;
+	crow::websocket::connection* conn;
+	bool closed;
+	std::string globusID;
+	std::size_t subscription;
+	///The last readiness state sent, if any
+	boost::optional<bool> lastSent;
+	
+	explicit ReadinessStream(crow::websocket::connection& conn):
+	conn(&conn),closed(false),subscription(0){}
+	
+	///Send the pod's readiness if it has changed since it was last sent
+	///\pre mut held
+	void update(const ClusterState& cluster, const std::string& podName){
+		if(closed)
+			return;
+		bool ready=podIsReady(cluster,globusID,podName);
+		if(lastSent && *lastSent==ready)
+			return;
+		conn->send_text(readinessJSON(ready));
+		lastSent=ready;
+	}
+};
+
+///Handle a message on a readiness websocket. The message is expected to be the
+///ID of a user, after which the readiness of that user's pod is sent 
+///immediately, and again every time it changes. 
+void readinessStreamMessage(DataStore& store, JobQueue& jobs, IdleReaper& reaper, const kubernetes::Client& kube, ClusterState& cluster, crow::websocket::connection& conn, const std::string& globusID){
+	auto& stream=*static_cast<std::shared_ptr<ReadinessStream>*>(conn.userdata());
+	std::lock_guard<std::mutex> lock(stream->mut);
+	if(!stream->globusID.empty()) //already watching
+		return;
+	reaper.touch(globusID);
+	auto pod=findAccount(store,globusID);
+	if(!pod && !jobs.inProgress(globusID)){
+		conn.send_text(generateError("User not found"));
+		conn.close("User not found");
+		return;
+	}
+	std::cout << "streaming pod readiness for " << globusID << std::endl;
+	stream->globusID=globusID;
+	std::weak_ptr<ReadinessStream> weakStream=stream;
+	const std::string podName=currentPodName(store,kube,cluster,globusID,pod);
+	stream->subscription=cluster.subscribe(globusID,[weakStream,&cluster,podName]{
+		auto stream=weakStream.lock();
+		if(!stream)
+			return;
+		std::lock_guard<std::mutex> lock(stream->mut);
+		stream->update(cluster,podName);
+	});
+	stream->update(cluster,podName);
+}
+
+void readinessStreamClosed(ClusterState& cluster, crow::websocket::connection& conn){
+	auto stream=static_cast<std::shared_ptr<ReadinessStream>*>(conn.userdata());
+	{
+		std::lock_guard<std::mutex> lock((*stream)->mut);
+		(*stream)->closed=true;
+		if(!(*stream)->globusID.empty())
+			cluster.unsubscribe((*stream)->globusID,(*stream)->subscription);
+	}
+	delete stream;
+	conn.userdata(nullptr);
+}
+
+crow::response serviceDetails(const Configuration& config, DataStore& store, EndpointCache& endpoints, IdleReaper& reaper, const kubernetes::Client& kube, const ClusterState& cluster, const crow::request&, const std::string globusID){
+	std::cout << "getting service endpoint for " << globusID << std::endl;
+	reaper.touch(globusID);
+	auto account=findAccount(store,globusID);
 	if(!account)
 		return crow::response(404,generateError("User not found"));
+	if(account->podName.empty())
+		return crow::response(503,generateError("Sandbox is suspended"));
+	auto endpoint=endpoints.find(globusID);
+	//an entry for a pod which the account no longer uses is of no help
+	if(!endpoint || endpoint->podName!=account->podName){
+		endpoint=Endpoint{"","",0};
+		try{
+			endpoint->nodePort=lookupNodePort(kube,cluster,globusID,account->serviceName);
+			PodState pod=resolvePod(store,kube,cluster,globusID,*account);
+			endpoint->podName=pod.name;
+			endpoint->hostIP=pod.hostIP;
+		}catch(std::runtime_error& err){
+			return crow::response(500,generateError(err.what()));
+		}
+		if(endpoint->hostIP.empty())
+			return crow::response(500,generateError("Pod has not been assigned to a node"));
+		endpoints.store(globusID,*endpoint);
+	}
 	
+	rapidjson::Document response(rapidjson::kObjectType);
+	rapidjson::Document::AllocatorType& alloc = response.GetAllocator();
+	//!!!: This will only work if config.dnsName maps to the pod's hostIP
+	response.AddMember("endpoint", config.dnsName+":"+std::to_string(endpoint->nodePort), alloc);
+	return crow::response(to_string(response));
+}
+
+///Give a pod claimed from the warm pool its credentials. The pod identifies 
+///itself by its name and, as proof, its UID (the 'uid' query parameter). 
+crow::response poolClaim(WarmPool& pool, const crow::request& req, const std::string podName){
+	const char* uid=req.url_params.get("uid");
+	auto credentials=pool.collectCredentials(podName,uid?uid:"");
+	if(!credentials)
+		return crow::response(404,generateError("No credentials for this pod"));
+	std::cout << "pool pod " << podName << " collected its credentials" << std::endl;
+	crow::response res(*credentials);
+	res.set_header("Content-Type","text/plain");
+	return res;
+}
+
+///Delete a SLATE user, along with any groups of which it is the only member
+///\param slateID the ID of the user
+///\return a description of what went wrong, or the empty string on success
+std::string removeSlateUser(const Configuration& config, httpRequests::AsyncClient& slateRequests, const std::string& slateID){
 	auto makeURL=[&](std::string path){
 		return config.slateEndpoint+"/v1alpha3/"+path+"?token="+config.slateAdminToken;
 	};
 	
-	//delete anything solely owned by this SLATE account
 	//find groups to which the user belongs, in case they have no other members
-	auto response=httpRequests::httpGet(makeURL("users/"+account->slateID+"/groups"));
+	auto response=httpRequests::httpGet(makeURL("users/"+slateID+"/groups"));
+	if(response.status==404) //the user is already gone
+		return "";
 	if(response.status!=200){
 		std::cerr << "Error: " << response.body << std::endl;
-		return crow::response(500,generateError("Failed to fetch group memberships"));
+		return "Failed to fetch group memberships";
 	}
 	rapidjson::Document groupData;
-	try{
-		groupData.Parse(response.body);
-	}catch(std::runtime_error& err){
-		return crow::response(500,generateError("Unable to parse JSON from SLATE API"));
-	}
+	groupData.Parse(response.body);
+	if(groupData.HasParseError() || !groupData.HasMember("items") || !groupData["items"].IsArray())
+		return "Unable to parse JSON from SLATE API";
 	
+	std::string failure;
+	//check who the members of each group are (or simply how many there are), 
+	//all at once
+	std::vector<std::pair<std::string,std::future<httpRequests::Response>>> memberLookups;
 	for(const auto& item : groupData["items"].GetArray()){
 		std::string groupID=item["metadata"]["id"].GetString();
-		//check who the members of the group are (or simply how many there are)
-		response=httpRequests::httpGet(makeURL("groups/"+groupID+"/members"));
+		memberLookups.emplace_back(groupID,slateRequests.get(makeURL("groups/"+groupID+"/members")));
+	}
+	//As each lookup finishes, start deleting the group if necessary. Every 
+	//request is waited for, so that none is still running if one fails. 
+	std::vector<std::pair<std::string,std::future<httpRequests::Response>>> groupDeletions;
+	for(auto& lookup : memberLookups){
+		const std::string& groupID=lookup.first;
+		try{
+			response=lookup.second.get();
+		}catch(std::runtime_error& err){
+			std::cerr << "Error: " << err.what() << std::endl;
+			failure="Failed to fetch group members";
+			continue;
+		}
 		if(response.status!=200){
 			std::cerr << "Error: " << response.body << std::endl;
-			return crow::response(500,generateError("Failed to fetch group members"));
+			failure="Failed to fetch group members";
+			continue;
 		}
 		rapidjson::Document groupMembers;
-		try{
-			groupMembers.Parse(response.body);
-		}catch(std::runtime_error& err){
-			return crow::response(500,generateError("Unable to parse JSON from SLATE API"));
+		groupMembers.Parse(response.body.c_str());
+		if(groupMembers.HasParseError() || !groupMembers.HasMember("items")){
+			failure="Unable to parse JSON from SLATE API";
+			continue;
 		}
 		if(groupMembers["items"].GetArray().Size()==1){
 			//The group has only one member, and we know the user to be deleted 
 			//must be that member, so we should delete it. 
-			response=httpRequests::httpDelete(makeURL("groups/"+groupID));
-			if(response.status!=200){
-				std::cerr << "Error: " << response.body << std::endl;
-				return crow::response(500,generateError("Failed to delete group "+groupID));
-			}
+			groupDeletions.emplace_back(groupID,slateRequests.del(makeURL("groups/"+groupID)));
 		}
 	}
+	for(auto& deletion : groupDeletions){
+		try{
+			response=deletion.second.get();
+		}catch(std::runtime_error& err){
+			response=httpRequests::Response{0,err.what()};
+		}
+		if(response.status!=200){
+			std::cerr << "Error: " << response.body << std::endl;
+			failure="Failed to delete group "+deletion.first;
+		}
+	}
+	if(!failure.empty())
+		return failure;
 	
 	//delete the corresponding SLATE account
-	response=httpRequests::httpDelete(makeURL("users/"+account->slateID));
-	if(response.status!=200){
+	response=httpRequests::httpDelete(makeURL("users/"+slateID));
+	if(response.status!=200 && response.status!=404){
 		std::cerr << "Error: " << response.body << std::endl;
-		return crow::response(500,generateError("Failed to delete SLATE account"));
-	}
-	//delete the deployment
-	auto result=runCommand("kubectl",{"delete","deployment",account->deploymentName,"-n=tutorial"});
-	if(result.status!=0)
-		return crow::response(500,generateError("kubectl delete deployment failed: "+result.error));
-	//delete the service
-	result=runCommand("kubectl",{"delete","service",account->serviceName,"-n=tutorial"});
-	if(result.status!=0)
-		return crow::response(500,generateError("kubectl delete service failed: "+result.error));
-	//delete the secret
-	result=runCommand("kubectl",{"delete","secret",account->secretName,"-n=tutorial"});
-	if(result.status!=0)
-		return crow::response(500,generateError("kubectl delete secret failed: "+result.error));
+		return "Failed to delete SLATE account";
+	}
+	return "";
+}
+
+///Clean up everything which was created for a deleted account, and then 
+///remove its record. Each step may be repeated safely, and progress with the 
+///SLATE user is recorded, so that a later attempt can finish what a failed 
+///one started. 
+///\throws std::runtime_error if any step fails
+void collectAccount(const Configuration& config, DataStore& store, PortAllocator& ports, JobQueue& jobs, EndpointCache& endpoints, httpRequests::AsyncClient& slateRequests, const kubernetes::Client& kube, const std::string& globusID){
+	auto account=store.find(globusID);
+	if(!account) //already finished
+		return;
+	std::cout << "cleaning up deleted account " << globusID << std::endl;
 	
-	store.remove(globusID);
+	//Delete the kubernetes objects concurrently with each other and with the 
+	//SLATE cleanup below. The server removes a deployment's pods in the 
+	//background, so there is no need to wait for them. Should this function 
+	//throw the futures' destructors still wait for the deletions. 
+	std::vector<std::pair<std::string,std::future<httpRequests::Response>>> objectDeletions;
+	auto removeObject=[&](kubernetes::Kind kind, const std::string& objectName, const std::string& description){
+		objectDeletions.emplace_back(description,std::async(std::launch::async,[&kube,kind,objectName]{
+			return kube.remove(kind,sandboxNamespace,objectName,"Background");
+		}));
+	};
+	//for a sandbox claimed from the warm pool there is a bare pod instead of a 
+	//deployment
+	if(!account->deploymentName.empty())
+		removeObject(kubernetes::Kind::Deployment,account->deploymentName,"deployment");
+	else if(!account->podName.empty())
+		removeObject(kubernetes::Kind::Pod,account->podName,"pod");
+	if(!account->serviceName.empty())
+		removeObject(kubernetes::Kind::Service,account->serviceName,"service");
+	if(!account->secretName.empty())
+		removeObject(kubernetes::Kind::Secret,account->secretName,"secret");
+	
+	std::string failure;
+	//an empty SLATE ID means that an earlier attempt already deleted the user
+	if(!account->slateID.empty()){
+		failure=removeSlateUser(config,slateRequests,account->slateID);
+		if(failure.empty()){
+			store.update(globusID,[](UserData& record){
+				record.slateID.clear();
+				return true;
+			});
+		}
+	}
+	
+	//collect the results of the kubernetes deletions
+	//(an object which is already gone is as good as deleted)
+	for(auto& deletion : objectDeletions){
+		httpRequests::Response result;
+		try{
+			result=deletion.second.get();
+		}catch(std::runtime_error& err){
+			result=httpRequests::Response{0,err.what()};
+		}
+		if(result.status!=200 && result.status!=202 && result.status!=404)
+			failure="Failed to delete "+deletion.first+": "+kubernetes::errorMessage(result);
+	}
+	if(!failure.empty())
+		throw std::runtime_error(failure);
 	
-	return crow::response(200);
+	store.remove(globusID);
+	ports.release(account->servicePort);
+	jobs.forget(globusID);
+	endpoints.invalidate(globusID);
+	std::cout << "finished deleting account " << globusID << std::endl;
+}
+
+///Delete an account. The account's record is marked as deleted at once, and 
+///everything belonging to the account is cleaned up in the background. 
+crow::response deleteAccount(DataStore& store, JobQueue& jobs, EndpointCache& endpoints, RetryQueue& collector, const crow::request&, const std::string globusID){
+	auto account=store.find(globusID);
+	if(!account){
+		if(jobs.inProgress(globusID))
+			return crow::response(409,generateError("Account is still being created"));
+		return crow::response(404,generateError("User not found"));
+	}
+	if(!account->deleting && jobs.inProgress(globusID))
+		return crow::response(409,generateError("Account is being resumed"));
+	if(!account->deleting){
+		//set only the flag, so that nothing else written to the record since 
+		//it was read is lost
+		bool marked;
+		try{
+			marked=store.update(globusID,[](UserData& record){
+				if(record.deleting)
+					return false;
+				record.deleting=true;
+				return true;
+			});
+		}catch(std::runtime_error& err){
+			return crow::response(500,generateError(err.what()));
+		}
+		if(marked){
+			std::cout << "deleting account " << globusID << std::endl;
+			endpoints.invalidate(globusID);
+		}
+	}
+	collector.add(globusID);
+	return crow::response(202);
 }
 
 int main(int argc, char* argv[]){
 	Configuration config(argc, argv);
 	std::cout << "Configured SLATE endpoint: " << config.slateEndpoint << std::endl;
-	DataStore store(config.dataStorePath);
-	
 	unsigned int port=0;
 	{
 		std::istringstream is(config.portString);
@@ -544,19 +1909,75 @@ int main(int argc, char* argv[]){
 			return 1;
 		}
 	}
+	const ManifestTemplates templates(config);
+	{
+		httpRequests::ClientOptions httpOptions;
+		httpOptions.maxRequestsPerHost=parseUnsignedOption("maxRequestsPerHost",config.maxRequestsPerHost);
+		httpOptions.maxIdleHandles=parseUnsignedOption("idleConnections",config.idleConnections);
+		httpRequests::configureDefaultClient(httpOptions);
+	}
+	DataStore store(config.dataStorePath,
+	                parseUnsignedOption("dataStoreSyncInterval",config.dataStoreSyncInterval),
+	                parseUnsignedOption("dataStoreCompactionThreshold",config.dataStoreCompactionThreshold));
+	PortAllocator ports(config.portRanges,config.excludedPorts);
+	for(const auto& account : store.records()){
+		if(!ports.claim(account.second.servicePort))
+			std::cerr << "Warning: port " << account.second.servicePort << " of account " 
+			  << account.first << " is outside the configured ranges or already in use" << std::endl;
+	}
+	kubernetes::Client kube(kubernetes::loadConfig(config.kubeconfig));
+	EndpointCache endpoints(std::chrono::seconds(parseUnsignedOption("endpointCacheTTL",config.endpointCacheTTL)));
+	ClusterState cluster(kube,sandboxNamespace);
+	//a cached endpoint may be out of date once anything about its pod or 
+	//service changes
+	cluster.observe([&endpoints](const std::string& globusID){
+		if(globusID.empty())
+			endpoints.clear();
+		else
+			endpoints.invalidate(globusID);
+	});
+	cluster.start();
+	//pool pods fetch their credentials from the spawner at its public address, 
+	//unless told otherwise
+	std::string claimURL=config.poolClaimURL;
+	if(claimURL.empty())
+		claimURL=(config.sslCertificate.empty()?"http://":"https://")+config.dnsName+":"+std::to_string(port)+"/pool_claim";
+	WarmPool pool(kube,templates.pool,parseUnsignedOption("warmPoolSize",config.warmPoolSize),claimURL);
+	pool.setUp();
+	PodLocator locator(kube,cluster,parseUnsignedOption("podDiscoveryTimeout",config.podDiscoveryTimeout));
+	IdleReaper reaper(store,endpoints,kube,parseUnsignedOption("idleTimeout",config.idleTimeout));
+	reaper.start();
+	JobQueue jobs(parseUnsignedOption("provisioningWorkers",config.provisioningWorkers));
+	httpRequests::AsyncClient slateRequests(parseUnsignedOption("maxConcurrentSlateRequests",config.maxConcurrentSlateRequests));
+	RetryQueue collector([&](const std::string& globusID){ collectAccount(config,store,ports,jobs,endpoints,slateRequests,kube,globusID); },
+	                     parseUnsignedOption("deletionWorkers",config.deletionWorkers));
+	//finish any deletions which were interrupted by the last shutdown
+	for(const auto& account : store.records()){
+		if(account.second.deleting)
+			collector.add(account.first);
+	}
+	Reconciler reconciler(config,templates,store,jobs,kube,parseUnsignedOption("reconcileInterval",config.reconcileInterval));
+	reconciler.start();
 	
 	crow::SimpleApp server;
 	
 	CROW_ROUTE(server, "/account/<string>").methods("PUT"_method)(
-	  [&](const crow::request& req, std::string globusID){ return createAccount(config,store,req,globusID); });
+	  [&](const crow::request& req, std::string globusID){ return createAccount(config,templates,store,ports,jobs,pool,locator,endpoints,reaper,kube,req,globusID); });
+	CROW_ROUTE(server, "/account/<string>/status").methods("GET"_method)(
+	  [&](const crow::request& req, std::string globusID){ return accountStatus(store,jobs,req,globusID); });
 	CROW_ROUTE(server, "/account/<string>").methods("DELETE"_method)(
-	  [&](const crow::request& req, std::string globusID){ return deleteAccount(config,store,req,globusID); });
+	  [&](const crow::request& req, std::string globusID){ return deleteAccount(store,jobs,endpoints,collector,req,globusID); });
 	CROW_ROUTE(server, "/pod_ready/<string>").methods("GET"_method)(
-	  [&](const crow::request& req, std::string globusID){ return podReady(store,req,globusID); });
+	  [&](const crow::request& req, crow::response& res, std::string globusID){ podReadyWait(store,jobs,reaper,kube,cluster,req,res,globusID); });
+	CROW_ROUTE(server, "/pod_ready_stream").websocket()
+	  .onopen([&](crow::websocket::connection& conn){ conn.userdata(new std::shared_ptr<ReadinessStream>(std::make_shared<ReadinessStream>(conn))); })
+	  .onmessage([&](crow::websocket::connection& conn, const std::string& data, bool){ readinessStreamMessage(store,jobs,reaper,kube,cluster,conn,data); })
+	  .onclose([&](crow::websocket::connection& conn, const std::string&){ readinessStreamClosed(cluster,conn); });
 	CROW_ROUTE(server, "/service/<string>").methods("GET"_method)(
-	  [&](const crow::request& req, std::string globusID){ return serviceDetails(config,store,req,globusID); });
+	  [&](const crow::request& req, std::string globusID){ return serviceDetails(config,store,endpoints,reaper,kube,cluster,req,globusID); });
+	CROW_ROUTE(server, "/pool_claim/<string>").methods("GET"_method)(
+	  [&](const crow::request& req, std::string podName){ return poolClaim(pool,req,podName); });
 	
-	startReaper();
 	server.loglevel(crow::LogLevel::Warning);
 	if(!config.sslCertificate.empty())
 		server.port(port).ssl_file(config.sslCertificate,config.sslKey).multithreaded().run();